@@ -146,6 +146,53 @@ struct xz_buf {
 	size_t out_size;
 };
 
+/**
+ * struct xz_iovec - One segment of a scattered buffer
+ * @buf:        Beginning of the segment. Input segments are only read.
+ * @size:       Size of the segment
+ */
+struct xz_iovec {
+	uint8_t *buf;
+	size_t size;
+};
+
+/**
+ * struct xz_buf_iov - Like struct xz_buf but with scattered buffers
+ * @in:         Array of input segments. This may be NULL if and only if
+ *              in_count is zero.
+ * @in_count:   Number of elements in the in array
+ * @in_index:   Index of the current input segment. This must be less than
+ *              in_count unless in_count is zero.
+ * @in_pos:     Current position in in[in_index]. This must not exceed
+ *              in[in_index].size.
+ * @out:        Array of output segments. This may be NULL if and only if
+ *              out_count is zero.
+ * @out_count:  Number of elements in the out array
+ * @out_index:  Index of the current output segment. This must be less than
+ *              out_count unless out_count is zero.
+ * @out_pos:    Current position in out[out_index]. This must not exceed
+ *              out[out_index].size.
+ *
+ * The segments are used in order. When a segment has been used up, the
+ * index is incremented and the position is reset to zero, except after
+ * the last segment. So all input has been consumed when in_index is
+ * in_count - 1 and in_pos is in[in_index].size, and the same way for
+ * the output. Segments may be empty, and the arrays may be changed
+ * between calls. Compressed symbols may straddle input segments: the
+ * decoder keeps the few bytes it needs from the end of a segment.
+ */
+struct xz_buf_iov {
+	const struct xz_iovec *in;
+	size_t in_count;
+	size_t in_index;
+	size_t in_pos;
+
+	const struct xz_iovec *out;
+	size_t out_count;
+	size_t out_index;
+	size_t out_pos;
+};
+
 /*
  * struct xz_dec - Opaque type to hold the XZ decoder state
  */
@@ -196,6 +243,44 @@ struct xz_dec;
  */
 XZ_EXTERN struct xz_dec *xz_dec_init(enum xz_mode mode, uint32_t dict_max);
 
+/**
+ * xz_dec_memusage() - Get the memory needed by a decoder
+ * @mode:       Operation mode as with xz_dec_init()
+ * @dict_max:   Maximum dictionary size as with xz_dec_init()
+ *
+ * Return the number of bytes that xz_dec_init(mode, dict_max) allocates
+ * with XZ_SINGLE and XZ_PREALLOC. With XZ_DYNALLOC, this is the maximum
+ * that the decoder can allocate when decoding. This includes the decoder
+ * structures (the LZMA2 probability tables and the filter states) and
+ * the dictionary but not the overhead of the memory allocator. The
+ * result is exact for the build options in use.
+ */
+XZ_EXTERN uint64_t xz_dec_memusage(enum xz_mode mode, uint32_t dict_max);
+
+/**
+ * xz_dec_memusage_of() - Get the memory held by a decoder
+ * @s:          Decoder state allocated using xz_dec_init()
+ *
+ * Return the number of bytes currently allocated for s, counted like in
+ * xz_dec_memusage(). With XZ_DYNALLOC, this changes when the dictionary
+ * is reallocated for a bigger dictionary size or freed after a failed
+ * allocation. xz_dec_memusage_peak() gives the highest value. Neither
+ * exceeds xz_dec_memusage() with the same mode and dict_max.
+ */
+XZ_EXTERN uint64_t xz_dec_memusage_of(const struct xz_dec *s);
+
+/**
+ * xz_dec_memusage_peak() - Get the peak memory usage of a decoder
+ * @s:          Decoder state allocated using xz_dec_init()
+ *
+ * Return the biggest value that xz_dec_memusage_of(s) has had since
+ * xz_dec_init() or the latest xz_dec_reset(). xz_dec_reset() keeps the
+ * dictionary, so the peak starts again from the current usage. With
+ * XZ_SINGLE and XZ_PREALLOC, the usage doesn't change and this returns
+ * the same as xz_dec_memusage_of().
+ */
+XZ_EXTERN uint64_t xz_dec_memusage_peak(const struct xz_dec *s);
+
 /**
  * xz_dec_run() - Run the XZ decoder for a single XZ stream
  * @s:          Decoder state allocated using xz_dec_init()
@@ -258,6 +343,217 @@ XZ_EXTERN enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b);
 XZ_EXTERN enum xz_ret xz_dec_catrun(struct xz_dec *s, struct xz_buf *b,
 				    int finish);
 
+/**
+ * xz_dec_run_iov() - Run the XZ decoder with scattered input and output
+ * @s:          Decoder state allocated using xz_dec_init() in multi-call
+ *              mode (XZ_PREALLOC or XZ_DYNALLOC)
+ * @b:          Input and output segments
+ *
+ * This works like xz_dec_run() but the compressed data is read directly
+ * from the input segments, for example a chain of network buffers, and
+ * the uncompressed data is written directly into the output segments,
+ * for example pages of a page cache. Neither needs to be copied into
+ * a contiguous buffer first. Calls to xz_dec_run() and xz_dec_run_iov()
+ * may be mixed.
+ *
+ * Single-call mode isn't supported because then the output buffer is also
+ * used as the dictionary. XZ_OPTIONS_ERROR is returned in that case.
+ *
+ * xz_dec_run_iov() is only available if XZ_DEC_IOV was defined at compile
+ * time.
+ */
+XZ_EXTERN enum xz_ret xz_dec_run_iov(struct xz_dec *s, struct xz_buf_iov *b);
+
+/**
+ * xz_dec_skip() - Skip uncompressed data without writing it to b->out
+ * @s:          Decoder state allocated using xz_dec_init() in multi-call
+ *              mode (XZ_PREALLOC or XZ_DYNALLOC)
+ * @size:       Number of uncompressed bytes to skip in addition to what
+ *              is still pending from earlier calls
+ *
+ * The next size bytes of uncompressed data that xz_dec_run() or
+ * xz_dec_catrun() decode are thrown away instead of being written to
+ * b->out. The integrity check is still verified. This is faster than
+ * decoding into a throwaway buffer because, in Blocks that use only
+ * LZMA2, the data is never copied out of the dictionary. With BCJ and
+ * Delta filters, the data is decoded in small pieces into a buffer
+ * inside the decoder state.
+ *
+ * Return value is the number of bytes that are still to be skipped,
+ * including size. xz_dec_skip(s, 0) can be used to see how much of the
+ * earlier requests is pending. If the end of the stream is reached
+ * first, the remaining amount stays pending until xz_dec_reset().
+ *
+ * If size is XZ_SKIP_ALL or the total wouldn't fit in uint64_t, all
+ * uncompressed data is skipped until xz_dec_reset(). This is a verify-only
+ * mode: the Block Checks and the Index are verified as usual but b->out
+ * isn't used at all, so it may be NULL and b->out_size may be zero.
+ *
+ * xz_dec_skip() is only available if XZ_DEC_SKIP was defined at compile
+ * time. It has no effect in single-call mode.
+ */
+XZ_EXTERN uint64_t xz_dec_skip(struct xz_dec *s, uint64_t size);
+
+/* Special value for xz_dec_skip() to skip everything */
+#define XZ_SKIP_ALL ((uint64_t)-1)
+
+/**
+ * xz_dec_save_size() - Get the size of the saved decoder state
+ * @s:          Decoder state allocated using xz_dec_init()
+ *
+ * Return value is the number of bytes that xz_dec_save() would write now.
+ * In the middle of a Block this includes the used part of the dictionary.
+ */
+XZ_EXTERN size_t xz_dec_save_size(const struct xz_dec *s);
+
+/**
+ * xz_dec_save() - Save the decoder state to a buffer
+ * @s:          Decoder state allocated using xz_dec_init() in multi-call
+ *              mode (XZ_PREALLOC or XZ_DYNALLOC)
+ * @buf:        Buffer to hold the saved state
+ * @size:       Size of buf. This must be at least xz_dec_save_size(s).
+ *
+ * The decoder state can be saved between calls to xz_dec_run() or
+ * xz_dec_catrun(), for example to continue a long decompression in
+ * another process later. The state includes everything that is needed
+ * to continue decoding from the input position where the previous call
+ * stopped (b->in_pos), such as the dictionary contents and the pending
+ * amount to skip, so the caller has to save that position too.
+ * Restoring costs about as much as copying the saved state.
+ *
+ * Return value:
+ *  - XZ_OK: The state was written to buf.
+ *  - XZ_BUF_ERROR: buf is too small.
+ *  - XZ_OPTIONS_ERROR: s is in single-call mode.
+ *
+ * xz_dec_save(), xz_dec_save_size(), and xz_dec_restore() are only
+ * available if XZ_DEC_SAVE was defined at compile time.
+ */
+XZ_EXTERN enum xz_ret xz_dec_save(const struct xz_dec *s, uint8_t *buf,
+				  size_t size);
+
+/**
+ * xz_dec_restore() - Restore the decoder state saved with xz_dec_save()
+ * @s:          Decoder state allocated using xz_dec_init() in multi-call
+ *              mode. dict_max must be big enough for the dictionary
+ *              of the Block that was being decoded.
+ * @buf:        State saved with xz_dec_save()
+ * @size:       Size of the saved state
+ *
+ * The state must have been saved by the same build of XZ Embedded. The
+ * mode and dict_max of s, the callback set with xz_dec_set_event_cb(),
+ * and the setting from xz_dec_set_flush() are kept. The saved state is
+ * checked with CRC32, but it must still come from a trusted source: not
+ * every field is validated.
+ *
+ * Return value:
+ *  - XZ_OK: Decoding can be continued with the saved input position.
+ *  - XZ_FORMAT_ERROR: buf doesn't contain a saved decoder state.
+ *  - XZ_OPTIONS_ERROR: s is in single-call mode or the state was saved
+ *    by a different build.
+ *  - XZ_MEMLIMIT_ERROR: The dictionary is bigger than dict_max.
+ *  - XZ_MEM_ERROR: Allocating memory for the dictionary failed.
+ *  - XZ_DATA_ERROR: The saved state is corrupt.
+ *
+ * After an error, s is in the same state as after xz_dec_reset().
+ */
+XZ_EXTERN enum xz_ret xz_dec_restore(struct xz_dec *s, const uint8_t *buf,
+				     size_t size);
+
+/**
+ * xz_dec_set_flush() - Return from xz_dec_run() at LZMA2 chunk boundaries
+ * @s:          Decoder state allocated using xz_dec_init()
+ * @flush:      This is an int instead of bool to avoid requiring stdbool.h.
+ *              If true, xz_dec_run() and xz_dec_catrun() return XZ_OK
+ *              after each LZMA2 chunk even if there is more input and
+ *              output space left.
+ *
+ * Normally xz_dec_run() returns only when the input has been used up or
+ * the output buffer is full. With big buffers this delays the output
+ * that has already been decoded. For streaming with a low latency, such
+ * as sending a log to a socket while it is being decompressed, the
+ * output of each chunk can be passed on as soon as xz_dec_run() returns.
+ * LZMA2 chunks are at most 2 MiB of uncompressed data and usually much
+ * smaller. No XZ_BUF_ERROR is caused by this since each early return
+ * happens only after decoding a chunk.
+ *
+ * The setting stays over xz_dec_reset(). It has no effect in single-call
+ * mode.
+ *
+ * xz_dec_set_flush() and xz_dec_held() are only available if
+ * XZ_DEC_FLUSH was defined at compile time.
+ */
+XZ_EXTERN void xz_dec_set_flush(struct xz_dec *s, int flush);
+
+/**
+ * xz_dec_held() - Get the amount of decoded data not yet in b->out
+ * @s:          Decoder state allocated using xz_dec_init()
+ *
+ * Return value is the number of uncompressed bytes that the decoder has
+ * decoded but hasn't written to b->out yet. When b->out is full, the
+ * rest of an LZMA match is left to be written on the next call. A BCJ
+ * filter keeps up to 16 bytes until it has seen the bytes after them
+ * or until the end of the Block, so with a BCJ filter this can be
+ * non-zero even when there was output space left. In single-call mode
+ * and outside Blocks this is always zero.
+ */
+XZ_EXTERN size_t xz_dec_held(const struct xz_dec *s);
+
+/**
+ * struct xz_dec_stats - Counters of the work done by the LZMA2 decoder
+ * @literals:               Literals decoded after a literal
+ * @matched_literals:       Literals decoded right after a match or a rep,
+ *                          which use the byte at the distance of the latest
+ *                          match as extra context
+ * @dist_slots:             Matches with a new distance by the distance
+ *                          slot. Slots 0-3 are the distances 1-4 and the
+ *                          slots 2 * n and 2 * n + 1 together cover the
+ *                          distances from 2^n + 1 to 2^(n + 1).
+ * @reps:                   Matches that reused the latest (reps[0]) or one
+ *                          of the three earlier (reps[1-3]) distances
+ * @short_reps:             One-byte matches at the latest distance. These
+ *                          aren't included in reps[0].
+ * @match_bytes:            Bytes copied from the dictionary by all matches
+ * @lzma_chunks:            LZMA2 chunks with LZMA-compressed data
+ * @uncompressed_chunks:    LZMA2 chunks with uncompressed data
+ * @dict_resets:            Dictionary resets
+ * @state_resets:           LZMA state resets, including those done when
+ *                          new properties are set
+ * @temp_copies:            Times that the end of the input buffer or of
+ *                          an LZMA2 chunk was copied to an internal
+ *                          temporary buffer. A high count compared to
+ *                          lzma_chunks means that the input buffer is small.
+ */
+struct xz_dec_stats {
+	uint64_t literals;
+	uint64_t matched_literals;
+	uint64_t dist_slots[64];
+	uint64_t reps[4];
+	uint64_t short_reps;
+	uint64_t match_bytes;
+	uint64_t lzma_chunks;
+	uint64_t uncompressed_chunks;
+	uint64_t dict_resets;
+	uint64_t state_resets;
+	uint64_t temp_copies;
+};
+
+/**
+ * xz_dec_get_stats() - Get the statistics counters of the decoder
+ * @s:          Decoder initialized with xz_dec_init()
+ * @stats:      Pointer to a structure to fill
+ *
+ * The counters are zeroed by xz_dec_init() and xz_dec_reset(). Since
+ * single-call mode resets the decoder in the beginning of xz_dec_run(),
+ * the counters cover only the latest call in that mode.
+ *
+ * The counters are updated in the innermost loops of the decoder, so
+ * they make decompression a little slower. xz_dec_get_stats() is only
+ * available if XZ_DEC_STATS was defined at compile time.
+ */
+XZ_EXTERN void xz_dec_get_stats(const struct xz_dec *s,
+				struct xz_dec_stats *stats);
+
 /**
  * xz_dec_reset() - Reset an already allocated decoder state
  * @s:          Decoder state allocated using xz_dec_init()
@@ -278,6 +574,168 @@ XZ_EXTERN void xz_dec_reset(struct xz_dec *s);
  */
 XZ_EXTERN void xz_dec_end(struct xz_dec *s);
 
+/* Value in struct xz_info and struct xz_event for unknown sizes */
+#define XZ_SIZE_UNKNOWN ((uint64_t)-1)
+
+/**
+ * struct xz_info - Information from the headers of a .xz file
+ * @check:              Check ID from the Stream Header: 0 = None,
+ *                      1 = CRC32, 4 = CRC64, 10 = SHA-256
+ * @dict_size:          LZMA2 dictionary size of the first Block. In
+ *                      XZ_PREALLOC and XZ_DYNALLOC modes, dict_max given
+ *                      to xz_dec_init() must be at least this big to
+ *                      decode the Block. This is zero if the Stream has
+ *                      no Blocks.
+ * @bcj_id:             Filter ID of the BCJ filter in the first Block,
+ *                      or zero if there is none
+ * @delta_distance:     Distance of the Delta filter in the first Block,
+ *                      or zero if there is none
+ * @block_compressed:   Compressed Size from the first Block Header, or
+ *                      XZ_SIZE_UNKNOWN if it isn't stored there
+ * @block_uncompressed: Uncompressed Size from the first Block Header, or
+ *                      XZ_SIZE_UNKNOWN if it isn't stored there
+ * @index_size:         Size of the Index field of the last Stream
+ * @stream_compressed:  Size of the last Stream, excluding Stream Padding
+ * @stream_uncompressed: Uncompressed size of the last Stream
+ * @stream_blocks:      Number of Blocks in the last Stream
+ *
+ * The first six members are set by xz_probe() and the rest by
+ * xz_probe_tail(). xz_probe() sets the sizes of the last Stream to
+ * XZ_SIZE_UNKNOWN so it must be called first if both are used.
+ */
+struct xz_info {
+	uint32_t check;
+	uint32_t dict_size;
+	uint32_t bcj_id;
+	uint32_t delta_distance;
+	uint64_t block_compressed;
+	uint64_t block_uncompressed;
+	uint64_t index_size;
+	uint64_t stream_compressed;
+	uint64_t stream_uncompressed;
+	uint64_t stream_blocks;
+};
+
+/**
+ * xz_probe() - Get information from the beginning of a .xz file
+ * @buf:        The first bytes of the file
+ * @len:        Size of buf. 12 bytes are enough for the Stream Header
+ *              and 1036 bytes for the first Block Header of any file.
+ * @info:       Information about the file is stored here
+ *
+ * The Stream Header and the first Block Header are decoded without
+ * allocating any memory. This way the caller can see how much memory
+ * xz_dec_init() would need before creating a decoder.
+ *
+ * Return value:
+ *  - XZ_OK: The headers were decoded successfully and the decoder
+ *    supports the options used in them.
+ *  - XZ_BUF_ERROR: buf is too short to contain the headers.
+ *  - XZ_FORMAT_ERROR: buf doesn't begin with the .xz magic bytes.
+ *  - XZ_OPTIONS_ERROR: The headers use options that the decoder doesn't
+ *    support. The members of info that were decoded before the
+ *    unsupported option are valid.
+ *  - XZ_DATA_ERROR: The headers are corrupt.
+ *
+ * The CRC32 fields of the headers are verified, so xz_crc32_init() must
+ * have been called before xz_probe().
+ *
+ * xz_probe() and xz_probe_tail() are only available if XZ_DEC_PROBE was
+ * defined at compile time.
+ */
+XZ_EXTERN enum xz_ret xz_probe(const uint8_t *buf, size_t len,
+			       struct xz_info *info);
+
+/**
+ * xz_probe_tail() - Get information from the end of a .xz file
+ * @buf:        The last bytes of the file
+ * @len:        Size of buf
+ * @info:       Information about the last Stream is stored here
+ *
+ * The Stream Footer and the Index of the last Stream in the file are
+ * decoded. Stream Padding after the Stream is skipped. The CRC32 fields
+ * of the Stream Footer and the Index are verified, so xz_crc32_init()
+ * must have been called before xz_probe_tail().
+ *
+ * Return value:
+ *  - XZ_OK: info->index_size and the stream_* members were set.
+ *  - XZ_BUF_ERROR: buf is too short. If buf contains the Stream Footer,
+ *    info->index_size has been set. Then 12 + info->index_size bytes
+ *    plus the Stream Padding are needed from the end of the file.
+ *  - XZ_FORMAT_ERROR: buf doesn't end with a .xz Stream Footer.
+ *  - XZ_OPTIONS_ERROR: The Stream Flags use unsupported options.
+ *  - XZ_DATA_ERROR: The Stream Footer or the Index is corrupt.
+ */
+XZ_EXTERN enum xz_ret xz_probe_tail(const uint8_t *buf, size_t len,
+				    struct xz_info *info);
+
+/**
+ * enum xz_event_type - Type of a struct xz_event
+ * @XZ_EVENT_STREAM_START:  A Stream Header was decoded.
+ * @XZ_EVENT_BLOCK_START:   A Block Header was decoded.
+ * @XZ_EVENT_BLOCK_END:     A Block was decoded and its integrity check
+ *                          was verified.
+ * @XZ_EVENT_STREAM_END:    The Index and the Stream Footer were decoded
+ *                          and verified.
+ */
+enum xz_event_type {
+	XZ_EVENT_STREAM_START,
+	XZ_EVENT_BLOCK_START,
+	XZ_EVENT_BLOCK_END,
+	XZ_EVENT_STREAM_END
+};
+
+/**
+ * struct xz_event - Boundary of a Stream or a Block
+ * @type:           Type of the event
+ * @in_offset:      Offset of the first byte of the Stream or the Block
+ *                  in the compressed input
+ * @out_offset:     Offset of the first uncompressed byte of the Stream
+ *                  or the Block
+ * @compressed:     Compressed size of the Stream or the Block
+ * @uncompressed:   Uncompressed size of the Stream or the Block
+ *
+ * The offsets are counted from the start of the input since xz_dec_init()
+ * or xz_dec_reset(), so they continue over concatenated Streams and
+ * Stream Padding with xz_dec_catrun(). Data skipped with xz_dec_skip()
+ * is included in out_offset.
+ *
+ * The sizes are known only in the *_END events. The size of a Block
+ * includes the Block Header, the Block Padding, and the Check, and the
+ * size of a Stream excludes the Stream Padding that follows it. In the
+ * *_START events the sizes are XZ_SIZE_UNKNOWN.
+ */
+struct xz_event {
+	enum xz_event_type type;
+	uint64_t in_offset;
+	uint64_t out_offset;
+	uint64_t compressed;
+	uint64_t uncompressed;
+};
+
+/**
+ * xz_dec_set_event_cb() - Set a function to call at Stream and Block
+ *                         boundaries
+ * @s:          Decoder state allocated using xz_dec_init()
+ * @cb:         Function to call from xz_dec_run() and xz_dec_catrun(),
+ *              or NULL to disable the events
+ * @opaque:     Passed as is as the first argument of cb
+ *
+ * The events make it possible to build an index for random access while
+ * decoding a file once from start to end, without decoding the Index
+ * from the end of the file separately. The *_END events are delivered
+ * only after the data has been verified. The callback must not call the
+ * xz_dec_* functions with the same decoder state.
+ *
+ * The callback stays set over xz_dec_reset().
+ *
+ * xz_dec_set_event_cb() is only available if XZ_DEC_EVENTS was defined
+ * at compile time.
+ */
+XZ_EXTERN void xz_dec_set_event_cb(struct xz_dec *s,
+		void (*cb)(void *opaque, const struct xz_event *event),
+		void *opaque);
+
 /**
  * DOC: MicroLZMA decompressor
  *
@@ -374,6 +832,27 @@ XZ_EXTERN void xz_dec_microlzma_reset(struct xz_dec_microlzma *s,
 XZ_EXTERN enum xz_ret xz_dec_microlzma_run(struct xz_dec_microlzma *s,
 					   struct xz_buf *b);
 
+/**
+ * xz_dec_microlzma_run_iov() - Run the MicroLZMA decoder with scattered
+ *                              input and output
+ * @s:          Decoder state allocated with XZ_PREALLOC and initialized
+ *              using xz_dec_microlzma_reset()
+ * @b:          Input and output segments
+ *
+ * This works like xz_dec_microlzma_run() but the input is read from and
+ * the output is written into the segments in b. The buf member of
+ * an output segment may be NULL to skip over the next size bytes of
+ * uncompressed data.
+ *
+ * XZ_SINGLE isn't supported because then the output buffer is also used
+ * as the dictionary. XZ_OPTIONS_ERROR is returned in that case.
+ *
+ * xz_dec_microlzma_run_iov() is only available if XZ_DEC_IOV was defined
+ * at compile time.
+ */
+XZ_EXTERN enum xz_ret xz_dec_microlzma_run_iov(struct xz_dec_microlzma *s,
+					       struct xz_buf_iov *b);
+
 /**
  * xz_dec_microlzma_end() - Free the memory allocated for the decoder state
  * @s:          Decoder state allocated using xz_dec_microlzma_alloc().
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: 0BSD */
+
+/*
+ * Tracepoints of the XZ decoder
+ *
+ * These show where the time goes in long decompressions. The arguments
+ * are the same as in the USDT probes of userspace builds of XZ Embedded.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xz
+
+#if !defined(_TRACE_XZ_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_XZ_H
+
+#include <linux/tracepoint.h>
+
+/* A Stream Header was decoded. check is enum xz_check. */
+TRACE_EVENT(xz_stream_header,
+	TP_PROTO(unsigned int check),
+	TP_ARGS(check),
+	TP_STRUCT__entry(
+		__field(unsigned int, check)
+	),
+	TP_fast_assign(
+		__entry->check = check;
+	),
+	TP_printk("check=%u", __entry->check)
+);
+
+/*
+ * A Block Header was decoded. The sizes are U64_MAX if they aren't
+ * stored in the Block Header.
+ */
+TRACE_EVENT(xz_block_start,
+	TP_PROTO(u32 header_size, u64 compressed, u64 uncompressed),
+	TP_ARGS(header_size, compressed, uncompressed),
+	TP_STRUCT__entry(
+		__field(u32, header_size)
+		__field(u64, compressed)
+		__field(u64, uncompressed)
+	),
+	TP_fast_assign(
+		__entry->header_size = header_size;
+		__entry->compressed = compressed;
+		__entry->uncompressed = uncompressed;
+	),
+	TP_printk("header_size=%u compressed=%llu uncompressed=%llu",
+		  __entry->header_size, __entry->compressed,
+		  __entry->uncompressed)
+);
+
+/*
+ * The Compressed Data and the Block Padding were decoded and the check
+ * will be verified next. The time until xz_block_end is spent on that.
+ */
+TRACE_EVENT(xz_block_check,
+	TP_PROTO(unsigned int check),
+	TP_ARGS(check),
+	TP_STRUCT__entry(
+		__field(unsigned int, check)
+	),
+	TP_fast_assign(
+		__entry->check = check;
+	),
+	TP_printk("check=%u", __entry->check)
+);
+
+/*
+ * The check of a Block was verified. compressed includes the Block
+ * Padding but not the Block Header or the Check field.
+ */
+TRACE_EVENT(xz_block_end,
+	TP_PROTO(u64 compressed, u64 uncompressed),
+	TP_ARGS(compressed, uncompressed),
+	TP_STRUCT__entry(
+		__field(u64, compressed)
+		__field(u64, uncompressed)
+	),
+	TP_fast_assign(
+		__entry->compressed = compressed;
+		__entry->uncompressed = uncompressed;
+	),
+	TP_printk("compressed=%llu uncompressed=%llu",
+		  __entry->compressed, __entry->uncompressed)
+);
+
+/*
+ * The header of an LZMA2 chunk was decoded. lzma is false for
+ * uncompressed chunks, whose two sizes are equal.
+ */
+TRACE_EVENT(xz_lzma2_chunk,
+	TP_PROTO(bool lzma, u32 compressed, u32 uncompressed),
+	TP_ARGS(lzma, compressed, uncompressed),
+	TP_STRUCT__entry(
+		__field(bool, lzma)
+		__field(u32, compressed)
+		__field(u32, uncompressed)
+	),
+	TP_fast_assign(
+		__entry->lzma = lzma;
+		__entry->compressed = compressed;
+		__entry->uncompressed = uncompressed;
+	),
+	TP_printk("lzma=%d compressed=%u uncompressed=%u",
+		  __entry->lzma, __entry->compressed, __entry->uncompressed)
+);
+
+/* A bigger dictionary buffer is being allocated in XZ_DYNALLOC mode. */
+TRACE_EVENT(xz_dict_alloc,
+	TP_PROTO(u32 size),
+	TP_ARGS(size),
+	TP_STRUCT__entry(
+		__field(u32, size)
+	),
+	TP_fast_assign(
+		__entry->size = size;
+	),
+	TP_printk("size=%u", __entry->size)
+);
+
+#endif /* _TRACE_XZ_H */
+
+#include <trace/define_trace.h>
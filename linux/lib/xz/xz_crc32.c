@@ -26,6 +26,93 @@
 
 STATIC_RW_DATA uint32_t xz_crc32_table[256];
 
+#ifdef XZ_SIMD_CLMUL
+/*
+ * With carry-less multiplication, the input is folded 64 bytes at a time
+ * into four 16-byte values and those are then folded into one. The CRC32
+ * of the last 16-byte value equals the CRC32 of everything folded into it.
+ *
+ * The bits of the CRC register are in reversed order: bit i is the
+ * coefficient of x^(31 - i). A product of a 64-bit and a 32-bit value from
+ * PCLMULQDQ is thus 33 bits short of where it would be in the 128-bit
+ * value, which is compensated by using x^(n - 33) mod P as the constants.
+ */
+static bool crc32_clmul;
+static uint64_t crc32_fold_512[2];
+static uint64_t crc32_fold_128[2];
+
+/* Calculate x^n mod P in the same bit order as the CRC32 register. */
+static uint32_t crc32_xpow(uint32_t n)
+{
+	uint32_t r = 0x80000000;
+
+	while (n-- > 0)
+		r = (r >> 1) ^ (0xEDB88320 & ~((r & 1) - 1));
+
+	return r;
+}
+
+static XZ_SIMD_CLMUL_FUNC inline __m128i crc32_fold(__m128i x, __m128i k,
+						      __m128i next)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+					   _mm_clmulepi64_si128(x, k, 0x11)),
+			     next);
+}
+
+/*
+ * Update the CRC32 register with the first size & ~15 bytes of buf.
+ * crc has already been inverted by xz_crc32(). size must be at least 64.
+ */
+static XZ_SIMD_CLMUL_FUNC uint32_t crc32_clmul_update(const uint8_t *buf,
+						      size_t size,
+						      uint32_t crc)
+{
+	const __m128i k512 = _mm_loadu_si128((const __m128i *)crc32_fold_512);
+	const __m128i k128 = _mm_loadu_si128((const __m128i *)crc32_fold_128);
+	const __m128i *in = (const __m128i *)buf;
+	__m128i x0;
+	__m128i x1;
+	__m128i x2;
+	__m128i x3;
+	uint8_t tmp[16];
+	size_t i;
+
+	x0 = _mm_xor_si128(_mm_loadu_si128(in), _mm_cvtsi32_si128((int)crc));
+	x1 = _mm_loadu_si128(in + 1);
+	x2 = _mm_loadu_si128(in + 2);
+	x3 = _mm_loadu_si128(in + 3);
+	in += 4;
+	size -= 64;
+
+	while (size >= 64) {
+		x0 = crc32_fold(x0, k512, _mm_loadu_si128(in));
+		x1 = crc32_fold(x1, k512, _mm_loadu_si128(in + 1));
+		x2 = crc32_fold(x2, k512, _mm_loadu_si128(in + 2));
+		x3 = crc32_fold(x3, k512, _mm_loadu_si128(in + 3));
+		in += 4;
+		size -= 64;
+	}
+
+	x0 = crc32_fold(x0, k128, x1);
+	x0 = crc32_fold(x0, k128, x2);
+	x0 = crc32_fold(x0, k128, x3);
+
+	while (size >= 16) {
+		x0 = crc32_fold(x0, k128, _mm_loadu_si128(in++));
+		size -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)tmp, x0);
+
+	crc = 0;
+	for (i = 0; i < sizeof(tmp); ++i)
+		crc = xz_crc32_table[tmp[i] ^ (crc & 0xFF)] ^ (crc >> 8);
+
+	return crc;
+}
+#endif
+
 XZ_EXTERN void xz_crc32_init(void)
 {
 	const uint32_t poly = 0xEDB88320;
@@ -42,6 +129,14 @@ XZ_EXTERN void xz_crc32_init(void)
 		xz_crc32_table[i] = r;
 	}
 
+#ifdef XZ_SIMD_CLMUL
+	crc32_fold_512[0] = crc32_xpow(512 + 64 - 33);
+	crc32_fold_512[1] = crc32_xpow(512 - 33);
+	crc32_fold_128[0] = crc32_xpow(128 + 64 - 33);
+	crc32_fold_128[1] = crc32_xpow(128 - 33);
+	crc32_clmul = xz_cpu_has(XZ_CPU_CLMUL);
+#endif
+
 	return;
 }
 
@@ -49,6 +144,14 @@ XZ_EXTERN uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 {
 	crc = ~crc;
 
+#ifdef XZ_SIMD_CLMUL
+	if (crc32_clmul && size >= 64) {
+		crc = crc32_clmul_update(buf, size, crc);
+		buf += size & ~(size_t)15;
+		size &= 15;
+	}
+#endif
+
 	while (size != 0) {
 		crc = xz_crc32_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
 		--size;
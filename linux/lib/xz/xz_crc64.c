@@ -17,6 +17,83 @@
 
 STATIC_RW_DATA uint64_t xz_crc64_table[256];
 
+#ifdef XZ_SIMD_CLMUL
+/*
+ * A product of two 64-bit values is one bit short of where it would be
+ * in the 128-bit value, so the constants are x^(n - 1) mod P.
+ */
+static bool crc64_clmul;
+static uint64_t crc64_fold_512[2];
+static uint64_t crc64_fold_128[2];
+
+static uint64_t crc64_xpow(uint32_t n)
+{
+	uint64_t r = 0x8000000000000000ULL;
+
+	while (n-- > 0)
+		r = (r >> 1) ^ (0xC96C5795D7870F42ULL & ~((r & 1) - 1));
+
+	return r;
+}
+
+static XZ_SIMD_CLMUL_FUNC inline __m128i crc64_fold(__m128i x, __m128i k,
+						      __m128i next)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+					   _mm_clmulepi64_si128(x, k, 0x11)),
+			     next);
+}
+
+static XZ_SIMD_CLMUL_FUNC uint64_t crc64_clmul_update(const uint8_t *buf,
+						      size_t size,
+						      uint64_t crc)
+{
+	const __m128i k512 = _mm_loadu_si128((const __m128i *)crc64_fold_512);
+	const __m128i k128 = _mm_loadu_si128((const __m128i *)crc64_fold_128);
+	const __m128i *in = (const __m128i *)buf;
+	__m128i x0;
+	__m128i x1;
+	__m128i x2;
+	__m128i x3;
+	uint8_t tmp[16];
+	size_t i;
+
+	x0 = _mm_xor_si128(_mm_loadu_si128(in),
+			   _mm_set_epi64x(0, (long long)crc));
+	x1 = _mm_loadu_si128(in + 1);
+	x2 = _mm_loadu_si128(in + 2);
+	x3 = _mm_loadu_si128(in + 3);
+	in += 4;
+	size -= 64;
+
+	while (size >= 64) {
+		x0 = crc64_fold(x0, k512, _mm_loadu_si128(in));
+		x1 = crc64_fold(x1, k512, _mm_loadu_si128(in + 1));
+		x2 = crc64_fold(x2, k512, _mm_loadu_si128(in + 2));
+		x3 = crc64_fold(x3, k512, _mm_loadu_si128(in + 3));
+		in += 4;
+		size -= 64;
+	}
+
+	x0 = crc64_fold(x0, k128, x1);
+	x0 = crc64_fold(x0, k128, x2);
+	x0 = crc64_fold(x0, k128, x3);
+
+	while (size >= 16) {
+		x0 = crc64_fold(x0, k128, _mm_loadu_si128(in++));
+		size -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)tmp, x0);
+
+	crc = 0;
+	for (i = 0; i < sizeof(tmp); ++i)
+		crc = xz_crc64_table[tmp[i] ^ (crc & 0xFF)] ^ (crc >> 8);
+
+	return crc;
+}
+#endif
+
 XZ_EXTERN void xz_crc64_init(void)
 {
 	/*
@@ -37,6 +114,14 @@ XZ_EXTERN void xz_crc64_init(void)
 		xz_crc64_table[i] = r;
 	}
 
+#ifdef XZ_SIMD_CLMUL
+	crc64_fold_512[0] = crc64_xpow(512 + 64 - 1);
+	crc64_fold_512[1] = crc64_xpow(512 - 1);
+	crc64_fold_128[0] = crc64_xpow(128 + 64 - 1);
+	crc64_fold_128[1] = crc64_xpow(128 - 1);
+	crc64_clmul = xz_cpu_has(XZ_CPU_CLMUL);
+#endif
+
 	return;
 }
 
@@ -44,6 +129,14 @@ XZ_EXTERN uint64_t xz_crc64(const uint8_t *buf, size_t size, uint64_t crc)
 {
 	crc = ~crc;
 
+#ifdef XZ_SIMD_CLMUL
+	if (crc64_clmul && size >= 64) {
+		crc = crc64_clmul_update(buf, size, crc);
+		buf += size & ~(size_t)15;
+		size &= 15;
+	}
+#endif
+
 	while (size != 0) {
 		crc = xz_crc64_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
 		--size;
@@ -48,6 +48,17 @@ struct xz_dec_bcj {
 	/* x86 filter state */
 	uint32_t x86_prev_mask;
 
+#ifdef XZ_SIMD_AVX2
+	/* True if the processor supports AVX2 */
+	bool avx2;
+#endif
+
+	/*
+	 * Position in b->out up to which the data written by the LZMA2
+	 * decoder has been filtered
+	 */
+	size_t out_filtered;
+
 	/* Temporary space to hold the variables from struct xz_buf */
 	uint8_t *out;
 	size_t out_pos;
@@ -76,6 +87,87 @@ struct xz_dec_bcj {
 	} temp;
 };
 
+#ifdef XZ_SIMD_SSE2
+/*
+ * Skip over bytes that cannot start an instruction that a BCJ filter would
+ * convert. A byte b is a candidate if (b & and1) == cmp1 or
+ * (b & and2) == cmp2, and only the bytes whose offsets from pos have their
+ * bit set in the 16-bit lanes mask are considered. Only whole 16-byte
+ * (or 32-byte with AVX2) blocks before buf[end] are examined.
+ *
+ * The return value is the position of the first candidate or the position
+ * where scanning stopped. Either way the caller continues from there with
+ * the scalar code, which checks the candidates and the last few bytes.
+ */
+#	ifdef XZ_SIMD_AVX2
+static XZ_SIMD_AVX2_FUNC size_t bcj_simd_skip_avx2(
+		const uint8_t *buf, size_t pos, size_t end,
+		uint8_t and1, uint8_t cmp1, uint8_t and2, uint8_t cmp2,
+		uint32_t lanes)
+{
+	const __m256i a1 = _mm256_set1_epi8((char)and1);
+	const __m256i c1 = _mm256_set1_epi8((char)cmp1);
+	const __m256i a2 = _mm256_set1_epi8((char)and2);
+	const __m256i c2 = _mm256_set1_epi8((char)cmp2);
+	__m256i v;
+	uint32_t found;
+
+	lanes |= lanes << 16;
+
+	while (pos + 32 <= end) {
+		v = _mm256_loadu_si256((const __m256i *)(buf + pos));
+		v = _mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_and_si256(v, a1), c1),
+			_mm256_cmpeq_epi8(_mm256_and_si256(v, a2), c2));
+		found = (uint32_t)_mm256_movemask_epi8(v) & lanes;
+		if (found != 0)
+			return pos + simd_ctz32(found);
+
+		pos += 32;
+	}
+
+	return pos;
+}
+#	endif
+
+static inline size_t bcj_simd_skip(const struct xz_dec_bcj *s,
+				   const uint8_t *buf, size_t pos, size_t end,
+				   uint8_t and1, uint8_t cmp1,
+				   uint8_t and2, uint8_t cmp2, uint32_t lanes)
+{
+	const __m128i a1 = _mm_set1_epi8((char)and1);
+	const __m128i c1 = _mm_set1_epi8((char)cmp1);
+	const __m128i a2 = _mm_set1_epi8((char)and2);
+	const __m128i c2 = _mm_set1_epi8((char)cmp2);
+	__m128i v;
+	uint32_t found;
+
+#	ifdef XZ_SIMD_AVX2
+	if (s->avx2)
+		pos = bcj_simd_skip_avx2(buf, pos, end,
+					 and1, cmp1, and2, cmp2, lanes);
+#	else
+	(void)s;
+#	endif
+
+	while (pos + 16 <= end) {
+		v = _mm_loadu_si128((const __m128i *)(buf + pos));
+		v = _mm_or_si128(_mm_cmpeq_epi8(_mm_and_si128(v, a1), c1),
+				 _mm_cmpeq_epi8(_mm_and_si128(v, a2), c2));
+		found = (uint32_t)_mm_movemask_epi8(v) & lanes;
+		if (found != 0)
+			return pos + simd_ctz32(found);
+
+		pos += 16;
+	}
+
+	return pos;
+}
+#else
+#	define bcj_simd_skip(s, buf, pos, end, and1, cmp1, and2, cmp2, lanes) \
+		((void)(s), (pos))
+#endif
+
 #ifdef XZ_DEC_X86
 /*
  * This is used to test the most significant byte of a memory address
@@ -86,6 +178,23 @@ static inline int bcj_x86_test_msbyte(uint8_t b)
 	return b == 0x00 || b == 0xFF;
 }
 
+/*
+ * Return the position of the first 0xE8 or 0xE9 byte in buf[i] to
+ * buf[size - 1], or i if i >= size, or size if there are no such bytes.
+ * Only these opcodes affect the filter state so the bytes in between
+ * can be skipped without looking at them one by one.
+ */
+static inline size_t bcj_x86_find(const struct xz_dec_bcj *s,
+				  const uint8_t *buf, size_t i, size_t size)
+{
+	i = bcj_simd_skip(s, buf, i, size, 0xFE, 0xE8, 0xFE, 0xE8, 0xFFFF);
+
+	while (i < size && (buf[i] & 0xFE) != 0xE8)
+		++i;
+
+	return i;
+}
+
 static size_t bcj_x86(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 {
 	static const bool mask_to_allowed_status[8]
@@ -105,10 +214,8 @@ static size_t bcj_x86(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 		return 0;
 
 	size -= 4;
-	for (i = 0; i < size; ++i) {
-		if ((buf[i] & 0xFE) != 0xE8)
-			continue;
-
+	for (i = bcj_x86_find(s, buf, 0, size); i < size;
+			i = bcj_x86_find(s, buf, i + 1, size)) {
 		prev_pos = i - prev_pos;
 		if (prev_pos > 3) {
 			prev_mask = 0;
@@ -349,6 +456,24 @@ static size_t bcj_sparc(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 #endif
 
 #ifdef XZ_DEC_ARM64
+/*
+ * Return the position of the next instruction whose most significant byte
+ * may indicate BL or ADRP. The other instructions are never converted.
+ * i and size are multiples of four.
+ */
+static inline size_t bcj_arm64_find(const struct xz_dec_bcj *s,
+				    const uint8_t *buf, size_t i, size_t size)
+{
+	i = bcj_simd_skip(s, buf, i + 3, size, 0xFC, 0x94, 0x9F, 0x90,
+			  0x1111) - 3;
+
+	while (i < size && (buf[i + 3] & 0xFC) != 0x94
+			&& (buf[i + 3] & 0x9F) != 0x90)
+		i += 4;
+
+	return i;
+}
+
 static size_t bcj_arm64(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 {
 	size_t i;
@@ -357,7 +482,8 @@ static size_t bcj_arm64(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 
 	size &= ~(size_t)3;
 
-	for (i = 0; i < size; i += 4) {
+	for (i = bcj_arm64_find(s, buf, 0, size); i < size;
+			i = bcj_arm64_find(s, buf, i + 4, size)) {
 		instr = get_unaligned_le32(buf + i);
 
 		if ((instr >> 26) == 0x25) {
@@ -390,6 +516,23 @@ static size_t bcj_arm64(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 #endif
 
 #ifdef XZ_DEC_RISCV
+/*
+ * Return the position of the next JAL or AUIPC opcode. Unlike elsewhere,
+ * size is the last position that may be returned. i is even and only
+ * the even positions are checked.
+ */
+static inline size_t bcj_riscv_find(const struct xz_dec_bcj *s,
+				    const uint8_t *buf, size_t i, size_t size)
+{
+	i = bcj_simd_skip(s, buf, i, size + 1, 0xFF, 0xEF, 0x7F, 0x17,
+			  0x5555);
+
+	while (i <= size && buf[i] != 0xEF && (buf[i] & 0x7F) != 0x17)
+		i += 2;
+
+	return i;
+}
+
 static size_t bcj_riscv(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 {
 	size_t i;
@@ -406,7 +549,8 @@ static size_t bcj_riscv(struct xz_dec_bcj *s, uint8_t *buf, size_t size)
 
 	size -= 8;
 
-	for (i = 0; i <= size; i += 2) {
+	for (i = bcj_riscv_find(s, buf, 0, size); i <= size;
+			i = bcj_riscv_find(s, buf, i + 2, size)) {
 		instr = buf[i];
 
 		if (instr == 0xEF) {
@@ -574,9 +718,12 @@ static void bcj_flush(struct xz_dec_bcj *s, struct xz_buf *b)
  */
 XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 				     struct xz_dec_lzma2 *lzma2,
+				     struct xz_dec_delta *delta,
 				     struct xz_buf *b)
 {
-	size_t out_start;
+#ifndef XZ_DEC_DELTA
+	(void)delta;
+#endif
 
 	/*
 	 * Flush pending already filtered data to the output buffer. Return
@@ -605,16 +752,34 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 	 * more output coming but hasn't returned XZ_STREAM_END yet.
 	 */
 	if (s->temp.size < b->out_size - b->out_pos || s->temp.size == 0) {
-		out_start = b->out_pos;
+		s->out_filtered = b->out_pos;
 		memcpy(b->out + b->out_pos, s->temp.buf, s->temp.size);
 		b->out_pos += s->temp.size;
 
-		s->ret = xz_dec_lzma2_run(lzma2, b);
+		/*
+		 * In multi-call mode the LZMA2 decoder calls
+		 * xz_dec_bcj_filter_out() after writing each chunk of
+		 * output, so most of the data has been filtered already
+		 * when it returns. In single-call mode b->out is also the
+		 * dictionary, so nothing can be filtered before the LZMA2
+		 * decoder has finished. The Delta filter needs to see the
+		 * data before the BCJ filter, so then this isn't done either.
+		 */
+#ifdef XZ_DEC_DELTA
+		if (delta != NULL)
+			s->ret = xz_dec_delta_run(delta, lzma2, b);
+		else
+#endif
+		if (s->single_call)
+			s->ret = xz_dec_lzma2_run(lzma2, b);
+		else
+			s->ret = xz_dec_lzma2_run_bcj(lzma2, b, s);
+
 		if (s->ret != XZ_STREAM_END
 				&& (s->ret != XZ_OK || s->single_call))
 			return s->ret;
 
-		bcj_apply(s, b->out, &out_start, b->out_pos);
+		bcj_apply(s, b->out, &s->out_filtered, b->out_pos);
 
 		/*
 		 * As an exception, if the next filter returned XZ_STREAM_END,
@@ -624,7 +789,7 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 		if (s->ret == XZ_STREAM_END)
 			return XZ_STREAM_END;
 
-		s->temp.size = b->out_pos - out_start;
+		s->temp.size = b->out_pos - s->out_filtered;
 		b->out_pos -= s->temp.size;
 		memcpy(s->temp.buf, b->out + b->out_pos, s->temp.size);
 
@@ -654,7 +819,12 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 		b->out_pos = s->temp.size;
 		b->out_size = sizeof(s->temp.buf);
 
-		s->ret = xz_dec_lzma2_run(lzma2, b);
+#ifdef XZ_DEC_DELTA
+		if (delta != NULL)
+			s->ret = xz_dec_delta_run(delta, lzma2, b);
+		else
+#endif
+			s->ret = xz_dec_lzma2_run(lzma2, b);
 
 		s->temp.size = b->out_pos;
 		b->out = s->out;
@@ -682,16 +852,67 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 	return s->ret;
 }
 
+XZ_EXTERN void xz_dec_bcj_filter_out(struct xz_dec_bcj *s,
+				     const struct xz_buf *b)
+{
+	bcj_apply(s, b->out, &s->out_filtered, b->out_pos);
+}
+
+#ifdef XZ_DEC_FLUSH
+XZ_EXTERN size_t xz_dec_bcj_held(const struct xz_dec_bcj *s)
+{
+	return s->temp.size;
+}
+#endif
+
 XZ_EXTERN struct xz_dec_bcj *xz_dec_bcj_create(bool single_call)
 {
 	struct xz_dec_bcj *s = kmalloc(sizeof(*s), GFP_KERNEL);
-	if (s != NULL)
+	if (s != NULL) {
 		s->single_call = single_call;
+#ifdef XZ_SIMD_AVX2
+		s->avx2 = xz_simd_avx2();
+#endif
+	}
 
 	return s;
 }
 
-XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id)
+XZ_EXTERN size_t xz_dec_bcj_memusage(void)
+{
+	return sizeof(struct xz_dec_bcj);
+}
+
+#ifdef XZ_DEC_SAVE
+XZ_EXTERN void xz_dec_bcj_save(const struct xz_dec_bcj *s, uint8_t *buf)
+{
+	memcpy(buf, s, sizeof(*s));
+}
+
+XZ_EXTERN enum xz_ret xz_dec_bcj_restore(struct xz_dec_bcj *s,
+					 const uint8_t *buf)
+{
+#ifdef XZ_SIMD_AVX2
+	/* The processor may be different now. */
+	bool avx2 = s->avx2;
+#endif
+
+	memcpy(s, buf, sizeof(*s));
+#ifdef XZ_SIMD_AVX2
+	s->avx2 = avx2;
+#endif
+	s->out = NULL;
+
+	if (!xz_dec_bcj_supported(s->type)
+			|| s->temp.size > sizeof(s->temp.buf)
+			|| s->temp.filtered > s->temp.size)
+		return XZ_DATA_ERROR;
+
+	return XZ_OK;
+}
+#endif
+
+XZ_EXTERN bool xz_dec_bcj_supported(uint8_t id)
 {
 	switch (id) {
 #ifdef XZ_DEC_X86
@@ -718,12 +939,17 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id)
 #ifdef XZ_DEC_RISCV
 	case BCJ_RISCV:
 #endif
-		break;
+		return true;
+	}
 
-	default:
-		/* Unsupported Filter ID */
+	return false;
+}
+
+XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id)
+{
+	/* Unsupported Filter ID */
+	if (!xz_dec_bcj_supported(id))
 		return XZ_OPTIONS_ERROR;
-	}
 
 	s->type = id;
 	s->ret = XZ_OK;
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Delta filter decoder
+ */
+
+#include "xz_private.h"
+
+/*
+ * The rest of the file is inside this ifdef. It makes things a little more
+ * convenient when building without support for the Delta filter.
+ */
+#ifdef XZ_DEC_DELTA
+
+struct xz_dec_delta {
+	/* True if we are operating in single-call mode. */
+	bool single_call;
+
+	/* Delta distance (1-256) */
+	uint32_t distance;
+
+	/*
+	 * Position of the next output byte in history. The output byte
+	 * at uncompressed offset x is stored in history[x & 0xFF].
+	 */
+	uint8_t pos;
+
+	/* The last 256 bytes of output */
+	uint8_t history[256];
+};
+
+#ifdef XZ_SIMD_SSE2
+/*
+ * Broadcast the last 1, 2, 4, or 8 bytes of prev to the whole vector.
+ * The result is added to the prefix sums of the current vector.
+ */
+static inline __m128i delta_carry(__m128i prev, uint32_t distance)
+{
+	switch (distance) {
+	case 1:
+		prev = _mm_unpackhi_epi8(prev, prev);
+		fallthrough;
+	case 2:
+		prev = _mm_shufflehi_epi16(prev, 0xFF);
+		fallthrough;
+	case 4:
+		return _mm_shuffle_epi32(prev, 0xFF);
+	default:
+		return _mm_unpackhi_epi64(prev, prev);
+	}
+}
+
+/*
+ * Undo the delta encoding of 16-byte blocks starting at buf[i] when the
+ * distance is 1, 2, 4, or 8. Each output byte is the sum of every
+ * distance-th input byte before it in the block plus the output byte
+ * from the end of the previous block that is a multiple of distance
+ * bytes back. The prefix sums are computed with log2(16 / distance)
+ * shifts and additions. i must be at least 16 if size >= i + 16.
+ */
+static size_t delta_sse2_small(uint8_t *buf, size_t i, size_t size,
+			       uint32_t distance)
+{
+	__m128i prev;
+	__m128i v;
+
+	if (i + 16 > size)
+		return i;
+
+	prev = _mm_loadu_si128((const __m128i *)(buf + i - 16));
+
+	while (i + 16 <= size) {
+		v = _mm_loadu_si128((const __m128i *)(buf + i));
+
+		switch (distance) {
+		case 1:
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+			fallthrough;
+		case 2:
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+			fallthrough;
+		case 4:
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+			fallthrough;
+		default:
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+			break;
+		}
+
+		prev = _mm_add_epi8(v, delta_carry(prev, distance));
+		_mm_storeu_si128((__m128i *)(buf + i), prev);
+		i += 16;
+	}
+
+	return i;
+}
+
+/*
+ * With distance >= 16 the bytes that are needed for a 16-byte block
+ * have already been decoded, so a plain vector addition is enough.
+ */
+static size_t delta_sse2_large(uint8_t *buf, size_t i, size_t size,
+			       uint32_t distance)
+{
+	__m128i v;
+
+	while (i + 16 <= size) {
+		v = _mm_loadu_si128((const __m128i *)(buf + i));
+		v = _mm_add_epi8(v, _mm_loadu_si128(
+				(const __m128i *)(buf + i - distance)));
+		_mm_storeu_si128((__m128i *)(buf + i), v);
+		i += 16;
+	}
+
+	return i;
+}
+#endif
+
+/* Undo the delta encoding of buf[0] to buf[size - 1] in place. */
+static void delta_decode(struct xz_dec_delta *s, uint8_t *buf, size_t size)
+{
+	size_t i;
+	size_t n;
+
+	/* The first distance bytes need the history from earlier calls. */
+	n = min_t(size_t, size, s->distance);
+	for (i = 0; i < n; ++i)
+		buf[i] += s->history[(uint8_t)(s->pos + i - s->distance)];
+
+#ifdef XZ_SIMD_SSE2
+	if (s->distance >= 16) {
+		i = delta_sse2_large(buf, i, size, s->distance);
+	} else if ((s->distance & (s->distance - 1)) == 0) {
+		while (i < 16 && i < size) {
+			buf[i] += buf[i - s->distance];
+			++i;
+		}
+
+		i = delta_sse2_small(buf, i, size, s->distance);
+	}
+#endif
+
+	for (; i < size; ++i)
+		buf[i] += buf[i - s->distance];
+
+	/* Remember the last 256 bytes for the next call. */
+	i = size > sizeof(s->history) ? size - sizeof(s->history) : 0;
+	for (; i < size; ++i)
+		s->history[(uint8_t)(s->pos + i)] = buf[i];
+
+	s->pos += (uint8_t)size;
+}
+
+XZ_EXTERN enum xz_ret xz_dec_delta_run(struct xz_dec_delta *s,
+				       struct xz_dec_lzma2 *lzma2,
+				       struct xz_buf *b)
+{
+	size_t out_start = b->out_pos;
+	enum xz_ret ret;
+
+	ret = xz_dec_lzma2_run(lzma2, b);
+
+	/*
+	 * In single-call mode b->out is also the LZMA2 dictionary, so the
+	 * data may be modified only after the LZMA2 decoder has finished.
+	 */
+	if (ret == XZ_STREAM_END || (ret == XZ_OK && !s->single_call))
+		delta_decode(s, b->out + out_start, b->out_pos - out_start);
+
+	return ret;
+}
+
+XZ_EXTERN struct xz_dec_delta *xz_dec_delta_create(bool single_call)
+{
+	struct xz_dec_delta *s = kmalloc(sizeof(*s), GFP_KERNEL);
+	if (s != NULL)
+		s->single_call = single_call;
+
+	return s;
+}
+
+XZ_EXTERN size_t xz_dec_delta_memusage(void)
+{
+	return sizeof(struct xz_dec_delta);
+}
+
+#ifdef XZ_DEC_SAVE
+XZ_EXTERN void xz_dec_delta_save(const struct xz_dec_delta *s, uint8_t *buf)
+{
+	memcpy(buf, s, sizeof(*s));
+}
+
+XZ_EXTERN enum xz_ret xz_dec_delta_restore(struct xz_dec_delta *s,
+					   const uint8_t *buf)
+{
+	memcpy(s, buf, sizeof(*s));
+
+	if (s->distance < 1 || s->distance > 256)
+		return XZ_DATA_ERROR;
+
+	return XZ_OK;
+}
+#endif
+
+XZ_EXTERN void xz_dec_delta_reset(struct xz_dec_delta *s, uint8_t props)
+{
+	s->distance = (uint32_t)props + 1;
+	s->pos = 0;
+	memzero(s->history, sizeof(s->history));
+}
+
+#endif
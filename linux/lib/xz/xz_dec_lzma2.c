@@ -24,6 +24,13 @@
  */
 #define LZMA_IN_REQUIRED 21
 
+/* Update a counter of struct xz_dec_stats if XZ_DEC_STATS is enabled. */
+#ifdef XZ_DEC_STATS
+#	define STATS_ADD(s, counter, n) ((s)->stats.counter += (n))
+#else
+#	define STATS_ADD(s, counter, n) ((void)0)
+#endif
+
 /*
  * Dictionary (history buffer)
  *
@@ -86,6 +93,12 @@ struct dictionary {
 	 */
 	uint32_t allocated;
 
+	/*
+	 * Biggest value of allocated since xz_dec_lzma2_create() or
+	 * xz_dec_lzma2_reset_peak(). This is used only with XZ_DYNALLOC.
+	 */
+	uint32_t peak;
+
 	/* Operation mode */
 	enum xz_mode mode;
 };
@@ -276,8 +289,43 @@ struct xz_dec_lzma2 {
 		uint32_t size;
 		uint8_t buf[3 * LZMA_IN_REQUIRED];
 	} temp;
+
+#ifdef XZ_DEC_BCJ
+	/*
+	 * BCJ filter to apply on the data written to b->out. This is
+	 * non-NULL only during xz_dec_lzma2_run_bcj().
+	 */
+	struct xz_dec_bcj *bcj;
+#endif
+
+#ifdef XZ_DEC_SKIP
+	/*
+	 * .xz decoder whose integrity check is updated when skipping
+	 * output. This is non-NULL only during xz_dec_lzma2_run_skip().
+	 */
+	struct xz_dec *skip;
+#endif
+
+#ifdef XZ_DEC_FLUSH
+	/* Return after each chunk. This is set by xz_dec_lzma2_set_flush(). */
+	bool flush;
+#endif
+
+#ifdef XZ_DEC_STATS
+	/* Counters returned by xz_dec_get_stats() */
+	struct xz_dec_stats stats;
+#endif
 };
 
+#ifdef XZ_DEC_BCJ
+/*
+ * When a BCJ filter is applied from xz_dec_lzma2_run_bcj(), decode at most
+ * this many bytes at a time so that the data is still in the CPU cache when
+ * the filter processes it.
+ */
+#	define LZMA2_BCJ_CHUNK_MAX (16 << 10)
+#endif
+
 /**************
  * Dictionary *
  **************/
@@ -373,6 +421,12 @@ static bool dict_repeat(struct dictionary *dict, uint32_t *len, uint32_t dist)
 	return true;
 }
 
+#if defined(XZ_DEC_MICROLZMA) || defined(XZ_DEC_SKIP)
+#	define DICT_FLUSH_SUPPORTS_SKIPPING true
+#else
+#	define DICT_FLUSH_SUPPORTS_SKIPPING false
+#endif
+
 /* Copy uncompressed data as is from input to dictionary and output buffers. */
 static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 			      uint32_t *left)
@@ -411,8 +465,9 @@ static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 			 * Like above but for multi-call mode: use memmove()
 			 * to avoid undefined behavior with invalid input.
 			 */
-			memmove(b->out + b->out_pos, b->in + b->in_pos,
-					copy_size);
+			if (!DICT_FLUSH_SUPPORTS_SKIPPING || b->out != NULL)
+				memmove(b->out + b->out_pos,
+						b->in + b->in_pos, copy_size);
 		}
 
 		dict->start = dict->pos;
@@ -422,12 +477,6 @@ static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 	}
 }
 
-#ifdef XZ_DEC_MICROLZMA
-#	define DICT_FLUSH_SUPPORTS_SKIPPING true
-#else
-#	define DICT_FLUSH_SUPPORTS_SKIPPING false
-#endif
-
 /*
  * Flush pending data from dictionary to b->out. It is assumed that there is
  * enough space in b->out. This is guaranteed because caller uses dict_limit()
@@ -447,9 +496,10 @@ static uint32_t dict_flush(struct dictionary *dict, struct xz_buf *b)
 		 * has been allocated by us in this file; it's not
 		 * provided by the caller like in single-call mode.
 		 *
-		 * With MicroLZMA, b->out can be NULL to skip bytes that
-		 * the caller doesn't need. This cannot be done with XZ
-		 * because it would break BCJ filters.
+		 * With MicroLZMA and xz_dec_lzma2_run_skip(), b->out can
+		 * be NULL to skip bytes that the caller doesn't need.
+		 * This cannot be done with BCJ or Delta filters because
+		 * they need the output.
 		 */
 		if (!DICT_FLUSH_SUPPORTS_SKIPPING || b->out != NULL)
 			memcpy(b->out + b->out_pos, dict->buf + dict->start,
@@ -621,8 +671,10 @@ static void lzma_literal(struct xz_dec_lzma2 *s)
 	probs = lzma_literal_probs(s);
 
 	if (lzma_state_is_literal(s->lzma.state)) {
+		STATS_ADD(s, literals, 1);
 		symbol = rc_bittree(&s->rc, probs, 0x100);
 	} else {
+		STATS_ADD(s, matched_literals, 1);
 		symbol = 1;
 		match_byte = dict_get(&s->dict, s->lzma.rep0) << 1;
 		offset = 0x100;
@@ -691,6 +743,9 @@ static void lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 	probs = s->lzma.dist_slot[lzma_get_dist_state(s->lzma.len)];
 	dist_slot = rc_bittree(&s->rc, probs, DIST_SLOTS) - DIST_SLOTS;
 
+	STATS_ADD(s, dist_slots[dist_slot], 1);
+	STATS_ADD(s, match_bytes, s->lzma.len);
+
 	if (dist_slot < DIST_MODEL_START) {
 		s->lzma.rep0 = dist_slot;
 	} else {
@@ -725,15 +780,22 @@ static void lzma_rep_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 				s->lzma.state][pos_state])) {
 			lzma_state_short_rep(&s->lzma.state);
 			s->lzma.len = 1;
+			STATS_ADD(s, short_reps, 1);
+			STATS_ADD(s, match_bytes, 1);
 			return;
 		}
+
+		STATS_ADD(s, reps[0], 1);
 	} else {
 		if (!rc_bit(&s->rc, &s->lzma.is_rep1[s->lzma.state])) {
+			STATS_ADD(s, reps[1], 1);
 			tmp = s->lzma.rep1;
 		} else {
 			if (!rc_bit(&s->rc, &s->lzma.is_rep2[s->lzma.state])) {
+				STATS_ADD(s, reps[2], 1);
 				tmp = s->lzma.rep2;
 			} else {
+				STATS_ADD(s, reps[3], 1);
 				tmp = s->lzma.rep3;
 				s->lzma.rep3 = s->lzma.rep2;
 			}
@@ -747,6 +809,7 @@ static void lzma_rep_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 
 	lzma_state_long_rep(&s->lzma.state);
 	lzma_len(s, &s->lzma.rep_len_dec, pos_state);
+	STATS_ADD(s, match_bytes, s->lzma.len);
 }
 
 /* LZMA decoder core */
@@ -800,6 +863,8 @@ static void lzma_reset(struct xz_dec_lzma2 *s)
 	uint16_t *probs;
 	size_t i;
 
+	STATS_ADD(s, state_resets, 1);
+
 	s->lzma.state = STATE_LIT_LIT;
 	s->lzma.rep0 = 0;
 	s->lzma.rep1 = 0;
@@ -889,6 +954,7 @@ static bool lzma2_lzma(struct xz_dec_lzma2 *s, struct xz_buf *b)
 			tmp = in_avail;
 
 		memcpy(s->temp.buf + s->temp.size, b->in + b->in_pos, tmp);
+		STATS_ADD(s, temp_copies, 1);
 
 		if (s->temp.size + tmp == s->lzma2.compressed) {
 			memzero(s->temp.buf + s->temp.size + tmp,
@@ -949,6 +1015,7 @@ static bool lzma2_lzma(struct xz_dec_lzma2 *s, struct xz_buf *b)
 			in_avail = s->lzma2.compressed;
 
 		memcpy(s->temp.buf, b->in + b->in_pos, in_avail);
+		STATS_ADD(s, temp_copies, 1);
 		s->temp.size = in_avail;
 		b->in_pos += in_avail;
 	}
@@ -964,6 +1031,9 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 				       struct xz_buf *b)
 {
 	uint32_t tmp;
+#ifdef XZ_DEC_SKIP
+	size_t in_start;
+#endif
 
 	while (b->in_pos < b->in_size || s->lzma2.sequence == SEQ_LZMA_RUN) {
 		switch (s->lzma2.sequence) {
@@ -1005,6 +1075,7 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 				return XZ_STREAM_END;
 
 			if (tmp >= 0xE0 || tmp == 0x01) {
+				STATS_ADD(s, dict_resets, 1);
 				s->lzma2.need_props = true;
 				s->lzma2.need_dict_reset = false;
 				dict_reset(&s->dict, b);
@@ -1013,6 +1084,7 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 			}
 
 			if (tmp >= 0x80) {
+				STATS_ADD(s, lzma_chunks, 1);
 				s->lzma2.uncompressed = (tmp & 0x1F) << 16;
 				s->lzma2.sequence = SEQ_UNCOMPRESSED_1;
 
@@ -1039,6 +1111,7 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 				if (tmp > 0x02)
 					return XZ_DATA_ERROR;
 
+				STATS_ADD(s, uncompressed_chunks, 1);
 				s->lzma2.sequence = SEQ_COMPRESSED_0;
 				s->lzma2.next_sequence = SEQ_COPY;
 			}
@@ -1067,6 +1140,13 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 			s->lzma2.compressed
 					+= (uint32_t)b->in[b->in_pos++] + 1;
 			s->lzma2.sequence = s->lzma2.next_sequence;
+
+			XZ_TRACE(lzma2_chunk,
+				 s->lzma2.next_sequence != SEQ_COPY,
+				 s->lzma2.compressed,
+				 s->lzma2.next_sequence != SEQ_COPY
+					? s->lzma2.uncompressed
+					: s->lzma2.compressed);
 			break;
 
 		case SEQ_PROPERTIES:
@@ -1099,13 +1179,27 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 			 * the output buffer yet, we may run this loop
 			 * multiple times without changing s->lzma2.sequence.
 			 */
+			tmp = s->lzma2.uncompressed;
+#ifdef XZ_DEC_BCJ
+			if (s->bcj != NULL && tmp > LZMA2_BCJ_CHUNK_MAX)
+				tmp = LZMA2_BCJ_CHUNK_MAX;
+#endif
 			dict_limit(&s->dict, min_t(size_t,
-					b->out_size - b->out_pos,
-					s->lzma2.uncompressed));
+					b->out_size - b->out_pos, tmp));
 			if (!lzma2_lzma(s, b))
 				return XZ_DATA_ERROR;
 
+#ifdef XZ_DEC_SKIP
+			if (s->skip != NULL)
+				xz_dec_skip_update(s->skip,
+						s->dict.buf + s->dict.start,
+						s->dict.pos - s->dict.start);
+#endif
 			s->lzma2.uncompressed -= dict_flush(&s->dict, b);
+#ifdef XZ_DEC_BCJ
+			if (s->bcj != NULL)
+				xz_dec_bcj_filter_out(s->bcj, b);
+#endif
 
 			if (s->lzma2.uncompressed == 0) {
 				if (s->lzma2.compressed > 0 || s->lzma.len > 0
@@ -1114,6 +1208,10 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 
 				rc_reset(&s->rc);
 				s->lzma2.sequence = SEQ_CONTROL;
+#ifdef XZ_DEC_FLUSH
+				if (s->flush)
+					return XZ_OK;
+#endif
 
 			} else if (b->out_pos == b->out_size
 					|| (b->in_pos == b->in_size
@@ -1125,11 +1223,27 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 			break;
 
 		case SEQ_COPY:
+#ifdef XZ_DEC_SKIP
+			in_start = b->in_pos;
+#endif
 			dict_uncompressed(&s->dict, b, &s->lzma2.compressed);
+#ifdef XZ_DEC_SKIP
+			if (s->skip != NULL)
+				xz_dec_skip_update(s->skip, b->in + in_start,
+						b->in_pos - in_start);
+#endif
+#ifdef XZ_DEC_BCJ
+			if (s->bcj != NULL)
+				xz_dec_bcj_filter_out(s->bcj, b);
+#endif
 			if (s->lzma2.compressed > 0)
 				return XZ_OK;
 
 			s->lzma2.sequence = SEQ_CONTROL;
+#ifdef XZ_DEC_FLUSH
+			if (s->flush)
+				return XZ_OK;
+#endif
 			break;
 		}
 	}
@@ -1137,6 +1251,59 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 	return XZ_OK;
 }
 
+#ifdef XZ_DEC_BCJ
+XZ_EXTERN enum xz_ret xz_dec_lzma2_run_bcj(struct xz_dec_lzma2 *s,
+					   struct xz_buf *b,
+					   struct xz_dec_bcj *bcj)
+{
+	enum xz_ret ret;
+
+	s->bcj = bcj;
+	ret = xz_dec_lzma2_run(s, b);
+	s->bcj = NULL;
+
+	return ret;
+}
+#endif
+
+#ifdef XZ_DEC_SKIP
+XZ_EXTERN enum xz_ret xz_dec_lzma2_run_skip(struct xz_dec_lzma2 *s,
+					    struct xz_buf *b,
+					    struct xz_dec *dec)
+{
+	enum xz_ret ret;
+
+	s->skip = dec;
+	ret = xz_dec_lzma2_run(s, b);
+	s->skip = NULL;
+
+	return ret;
+}
+#endif
+
+#ifdef XZ_DEC_FLUSH
+XZ_EXTERN void xz_dec_lzma2_set_flush(struct xz_dec_lzma2 *s, bool flush)
+{
+	s->flush = flush;
+}
+
+XZ_EXTERN size_t xz_dec_lzma2_held(const struct xz_dec_lzma2 *s)
+{
+	/*
+	 * Only the rest of a match can be pending. It is left over when
+	 * the output buffer gets full in the middle of the match.
+	 */
+	return s->lzma2.sequence == SEQ_LZMA_RUN ? s->lzma.len : 0;
+}
+#endif
+
+#ifdef XZ_DEC_STATS
+XZ_EXTERN struct xz_dec_stats *xz_dec_lzma2_stats(struct xz_dec_lzma2 *s)
+{
+	return &s->stats;
+}
+#endif
+
 XZ_EXTERN struct xz_dec_lzma2 *xz_dec_lzma2_create(enum xz_mode mode,
 						   uint32_t dict_max)
 {
@@ -1147,6 +1314,19 @@ XZ_EXTERN struct xz_dec_lzma2 *xz_dec_lzma2_create(enum xz_mode mode,
 	s->dict.mode = mode;
 	s->dict.size_max = dict_max;
 
+#ifdef XZ_DEC_BCJ
+	s->bcj = NULL;
+#endif
+#ifdef XZ_DEC_SKIP
+	s->skip = NULL;
+#endif
+#ifdef XZ_DEC_FLUSH
+	s->flush = false;
+#endif
+#ifdef XZ_DEC_STATS
+	memzero(&s->stats, sizeof(s->stats));
+#endif
+
 	if (DEC_IS_PREALLOC(mode)) {
 		s->dict.buf = vmalloc(dict_max);
 		if (s->dict.buf == NULL) {
@@ -1156,11 +1336,145 @@ XZ_EXTERN struct xz_dec_lzma2 *xz_dec_lzma2_create(enum xz_mode mode,
 	} else if (DEC_IS_DYNALLOC(mode)) {
 		s->dict.buf = NULL;
 		s->dict.allocated = 0;
+		s->dict.peak = 0;
 	}
 
 	return s;
 }
 
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage(enum xz_mode mode,
+					  uint32_t dict_size)
+{
+	/* The probability tables are inside struct xz_dec_lzma2. */
+	uint64_t size = sizeof(struct xz_dec_lzma2);
+
+	if (DEC_IS_MULTI(mode))
+		size += dict_size;
+
+	return size;
+}
+
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage_of(const struct xz_dec_lzma2 *s)
+{
+	if (DEC_IS_PREALLOC(s->dict.mode))
+		return xz_dec_lzma2_memusage(s->dict.mode, s->dict.size_max);
+
+	if (DEC_IS_DYNALLOC(s->dict.mode))
+		return xz_dec_lzma2_memusage(s->dict.mode, s->dict.allocated);
+
+	return xz_dec_lzma2_memusage(s->dict.mode, 0);
+}
+
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage_peak(const struct xz_dec_lzma2 *s)
+{
+	if (DEC_IS_DYNALLOC(s->dict.mode))
+		return xz_dec_lzma2_memusage(s->dict.mode, s->dict.peak);
+
+	return xz_dec_lzma2_memusage_of(s);
+}
+
+XZ_EXTERN void xz_dec_lzma2_reset_peak(struct xz_dec_lzma2 *s)
+{
+	s->dict.peak = s->dict.allocated;
+}
+
+/*
+ * In XZ_DYNALLOC mode, make sure that the dictionary buffer is big enough
+ * for dict->size bytes. Returns false if memory allocation fails.
+ */
+static bool dict_alloc(struct dictionary *dict)
+{
+	if (DEC_IS_DYNALLOC(dict->mode) && dict->allocated < dict->size) {
+		XZ_TRACE(dict_alloc, dict->size);
+		dict->allocated = dict->size;
+		vfree(dict->buf);
+		dict->buf = vmalloc(dict->size);
+		if (dict->buf == NULL) {
+			dict->allocated = 0;
+			return false;
+		}
+
+		if (dict->peak < dict->allocated)
+			dict->peak = dict->allocated;
+	}
+
+	return true;
+}
+
+#ifdef XZ_DEC_SAVE
+/*
+ * The dictionary contents are needed only after the first chunk has reset
+ * the dictionary. Then buf[0] to buf[full - 1] is the valid data because
+ * full reaches dict.end before pos wraps around.
+ */
+XZ_EXTERN size_t xz_dec_lzma2_save_size(const struct xz_dec_lzma2 *s)
+{
+	return sizeof(*s) + (s->lzma2.need_dict_reset ? 0 : s->dict.full);
+}
+
+XZ_EXTERN void xz_dec_lzma2_save(const struct xz_dec_lzma2 *s, uint8_t *buf)
+{
+	memcpy(buf, s, sizeof(*s));
+
+	if (!s->lzma2.need_dict_reset)
+		memcpy(buf + sizeof(*s), s->dict.buf, s->dict.full);
+}
+
+XZ_EXTERN enum xz_ret xz_dec_lzma2_restore(struct xz_dec_lzma2 *s,
+					   const uint8_t *buf, size_t size)
+{
+	/* These belong to this decoder, not to the saved one. */
+	struct dictionary dict = s->dict;
+#ifdef XZ_DEC_FLUSH
+	bool flush = s->flush;
+#endif
+	size_t full;
+
+	if (size < sizeof(*s))
+		return XZ_DATA_ERROR;
+
+	memcpy(s, buf, sizeof(*s));
+#ifdef XZ_DEC_FLUSH
+	s->flush = flush;
+#endif
+
+	s->dict.buf = dict.buf;
+	s->dict.mode = dict.mode;
+	s->dict.size_max = dict.size_max;
+	s->dict.allocated = dict.allocated;
+	s->dict.peak = dict.peak;
+	s->rc.in = NULL;
+#ifdef XZ_DEC_BCJ
+	s->bcj = NULL;
+#endif
+#ifdef XZ_DEC_SKIP
+	s->skip = NULL;
+#endif
+
+	if (s->dict.size > s->dict.size_max)
+		return XZ_MEMLIMIT_ERROR;
+
+	full = 0;
+	if (!s->lzma2.need_dict_reset) {
+		full = s->dict.full;
+		if (s->dict.end != s->dict.size || full > s->dict.end
+				|| s->dict.pos > s->dict.end
+				|| s->dict.start > s->dict.pos
+				|| s->dict.limit > s->dict.end)
+			return XZ_DATA_ERROR;
+	}
+
+	if (size - sizeof(*s) != full || s->temp.size > sizeof(s->temp.buf))
+		return XZ_DATA_ERROR;
+
+	if (!dict_alloc(&s->dict))
+		return XZ_MEM_ERROR;
+
+	memcpy(s->dict.buf, buf + sizeof(*s), full);
+	return XZ_OK;
+}
+#endif
+
 XZ_EXTERN enum xz_ret xz_dec_lzma2_reset(struct xz_dec_lzma2 *s, uint8_t props)
 {
 	/* This limits dictionary size to 3 GiB to keep parsing simpler. */
@@ -1176,17 +1490,8 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_reset(struct xz_dec_lzma2 *s, uint8_t props)
 
 		s->dict.end = s->dict.size;
 
-		if (DEC_IS_DYNALLOC(s->dict.mode)) {
-			if (s->dict.allocated < s->dict.size) {
-				s->dict.allocated = s->dict.size;
-				vfree(s->dict.buf);
-				s->dict.buf = vmalloc(s->dict.size);
-				if (s->dict.buf == NULL) {
-					s->dict.allocated = 0;
-					return XZ_MEM_ERROR;
-				}
-			}
-		}
+		if (!dict_alloc(&s->dict))
+			return XZ_MEM_ERROR;
 	}
 
 	s->lzma2.sequence = SEQ_CONTROL;
@@ -1289,6 +1594,25 @@ XZ_EXTERN enum xz_ret xz_dec_microlzma_run(struct xz_dec_microlzma *s_ptr,
 	}
 }
 
+#ifdef XZ_DEC_IOV
+XZ_EXTERN enum xz_ret xz_dec_microlzma_run_iov(struct xz_dec_microlzma *s,
+					       struct xz_buf_iov *v)
+{
+	struct xz_buf b;
+	enum xz_ret ret;
+
+	if (DEC_IS_SINGLE(s->s.dict.mode))
+		return XZ_OPTIONS_ERROR;
+
+	do {
+		xz_iov_load(v, &b);
+		ret = xz_dec_microlzma_run(s, &b);
+	} while (xz_iov_store(v, &b) && ret == XZ_OK);
+
+	return ret;
+}
+#endif
+
 XZ_EXTERN struct xz_dec_microlzma *xz_dec_microlzma_alloc(enum xz_mode mode,
 							  uint32_t dict_size)
 {
@@ -152,6 +152,31 @@ struct xz_dec {
 	bool bcj_active;
 #endif
 
+#ifdef XZ_DEC_DELTA
+	struct xz_dec_delta *delta;
+	bool delta_active;
+#endif
+
+#ifdef XZ_DEC_SKIP
+	/* Amount of uncompressed data still to be skipped */
+	uint64_t skip;
+#endif
+
+#ifdef XZ_DEC_EVENTS
+	/* Callback set with xz_dec_set_event_cb() and its argument */
+	void (*event_cb)(void *opaque, const struct xz_event *event);
+	void *event_opaque;
+
+	/*
+	 * Compressed offset of the current Stream and Block and
+	 * uncompressed offset of the current Stream from the beginning
+	 * of the input
+	 */
+	uint64_t stream_in;
+	uint64_t block_in;
+	uint64_t stream_out;
+#endif
+
 #ifdef XZ_USE_SHA256
 	/*
 	 * SHA-256 value in Block
@@ -179,6 +204,42 @@ static const uint8_t check_sizes[16] = {
 };
 #endif
 
+/* Get the size of the Check field of a Block. */
+static uint32_t check_size(const struct xz_dec *s)
+{
+#if defined(XZ_DEC_ANY_CHECK) || defined(XZ_USE_SHA256)
+	return check_sizes[s->check_type];
+#else
+	if (s->check_type == XZ_CHECK_CRC32)
+		return 4;
+
+	if (IS_CRC64(s->check_type))
+		return 8;
+
+	return 0;
+#endif
+}
+
+#ifdef XZ_DEC_EVENTS
+/* Report an event to the callback if one has been set. */
+static void event(struct xz_dec *s, enum xz_event_type type,
+		  uint64_t in_offset, uint64_t out_offset,
+		  uint64_t compressed, uint64_t uncompressed)
+{
+	struct xz_event e;
+
+	if (s->event_cb == NULL)
+		return;
+
+	e.type = type;
+	e.in_offset = in_offset;
+	e.out_offset = out_offset;
+	e.compressed = compressed;
+	e.uncompressed = uncompressed;
+	s->event_cb(s->event_opaque, &e);
+}
+#endif
+
 /*
  * Fill s->temp by copying data starting from b->in[b->in_pos]. Caller
  * must have set s->temp.pos and s->temp.size to indicate how much data
@@ -234,6 +295,29 @@ static enum xz_ret dec_vli(struct xz_dec *s, const uint8_t *in,
 	return XZ_OK;
 }
 
+/* Update the integrity check with uncompressed data. */
+static void check_update(struct xz_dec *s, const uint8_t *buf, size_t size)
+{
+	if (s->check_type == XZ_CHECK_CRC32)
+		s->crc = xz_crc32(buf, size, s->crc);
+#ifdef XZ_USE_CRC64
+	else if (s->check_type == XZ_CHECK_CRC64)
+		s->crc = xz_crc64(buf, size, s->crc);
+#endif
+#ifdef XZ_USE_SHA256
+	else if (s->check_type == XZ_CHECK_SHA256)
+		xz_sha256_update(buf, size, &s->sha256);
+#endif
+}
+
+#ifdef XZ_DEC_SKIP
+XZ_EXTERN void xz_dec_skip_update(struct xz_dec *s, const uint8_t *buf,
+				  size_t size)
+{
+	check_update(s, buf, size);
+}
+#endif
+
 /*
  * Decode the Compressed Data field from a Block. Update and validate
  * the observed compressed and uncompressed sizes of the Block so that
@@ -249,13 +333,31 @@ static enum xz_ret dec_vli(struct xz_dec *s, const uint8_t *in,
 static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
 {
 	enum xz_ret ret;
+#if defined(XZ_DEC_BCJ) || defined(XZ_DEC_DELTA)
+	struct xz_dec_delta *delta = NULL;
+#endif
 
 	s->in_start = b->in_pos;
 	s->out_start = b->out_pos;
 
+#ifdef XZ_DEC_DELTA
+	if (s->delta_active)
+		delta = s->delta;
+#endif
+
 #ifdef XZ_DEC_BCJ
 	if (s->bcj_active)
-		ret = xz_dec_bcj_run(s->bcj, s->lzma2, b);
+		ret = xz_dec_bcj_run(s->bcj, s->lzma2, delta, b);
+	else
+#endif
+#ifdef XZ_DEC_DELTA
+	if (delta != NULL)
+		ret = xz_dec_delta_run(delta, s->lzma2, b);
+	else
+#endif
+#ifdef XZ_DEC_SKIP
+	if (b->out == NULL)
+		ret = xz_dec_lzma2_run_skip(s->lzma2, b, s);
 	else
 #endif
 		ret = xz_dec_lzma2_run(s->lzma2, b);
@@ -272,19 +374,10 @@ static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
 				> s->block_header.uncompressed)
 		return XZ_DATA_ERROR;
 
-	if (s->check_type == XZ_CHECK_CRC32)
-		s->crc = xz_crc32(b->out + s->out_start,
-				b->out_pos - s->out_start, s->crc);
-#ifdef XZ_USE_CRC64
-	else if (s->check_type == XZ_CHECK_CRC64)
-		s->crc = xz_crc64(b->out + s->out_start,
-				b->out_pos - s->out_start, s->crc);
-#endif
-#ifdef XZ_USE_SHA256
-	else if (s->check_type == XZ_CHECK_SHA256)
-		xz_sha256_update(b->out + s->out_start,
-				b->out_pos - s->out_start, &s->sha256);
-#endif
+	/* When skipping, the LZMA2 decoder has updated the check already. */
+	if (b->out != NULL)
+		check_update(s, b->out + s->out_start,
+				b->out_pos - s->out_start);
 
 	if (ret == XZ_STREAM_END) {
 		if (s->block_header.compressed != VLI_UNKNOWN
@@ -298,16 +391,7 @@ static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
 			return XZ_DATA_ERROR;
 
 		s->block.hash.unpadded += s->block_header.size
-				+ s->block.compressed;
-
-#if defined(XZ_DEC_ANY_CHECK) || defined(XZ_USE_SHA256)
-		s->block.hash.unpadded += check_sizes[s->check_type];
-#else
-		if (s->check_type == XZ_CHECK_CRC32)
-			s->block.hash.unpadded += 4;
-		else if (IS_CRC64(s->check_type))
-			s->block.hash.unpadded += 8;
-#endif
+				+ s->block.compressed + check_size(s);
 
 		s->block.hash.uncompressed += s->block.uncompressed;
 		s->block.hash.crc32 = xz_crc32(
@@ -320,6 +404,55 @@ static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
 	return ret;
 }
 
+#ifdef XZ_DEC_SKIP
+/*
+ * Decode the Compressed Data field like dec_block() but throw away the
+ * uncompressed data. When there are no BCJ or Delta filters, the LZMA2
+ * decoder is run with b->out == NULL so that the data is only decoded
+ * into the dictionary. The filters need an output buffer, so s->temp.buf
+ * (unused while decoding a Block) is used for them.
+ */
+static enum xz_ret dec_block_skip(struct xz_dec *s, struct xz_buf *b)
+{
+	uint8_t *out = b->out;
+	size_t out_pos = b->out_pos;
+	size_t out_size = b->out_size;
+	size_t limit = (size_t)-1;
+	enum xz_ret ret;
+
+	b->out = NULL;
+
+#ifdef XZ_DEC_BCJ
+	if (s->bcj_active) {
+		b->out = s->temp.buf;
+		limit = sizeof(s->temp.buf);
+	}
+#endif
+#ifdef XZ_DEC_DELTA
+	if (s->delta_active) {
+		b->out = s->temp.buf;
+		limit = sizeof(s->temp.buf);
+	}
+#endif
+
+	do {
+		b->out_pos = 0;
+		b->out_size = limit;
+		if (b->out_size > s->skip)
+			b->out_size = (size_t)s->skip;
+
+		ret = dec_block(s, b);
+		if (s->skip != XZ_SKIP_ALL)
+			s->skip -= b->out_pos;
+	} while (ret == XZ_OK && s->skip > 0 && b->out_pos == b->out_size);
+
+	b->out = out;
+	b->out_pos = out_pos;
+	b->out_size = out_size;
+	return ret;
+}
+#endif
+
 /* Update the Index size and the CRC32 value. */
 static void index_update(struct xz_dec *s, const struct xz_buf *b)
 {
@@ -496,6 +629,10 @@ static enum xz_ret dec_stream_footer(struct xz_dec *s)
 static enum xz_ret dec_block_header(struct xz_dec *s)
 {
 	enum xz_ret ret;
+#if defined(XZ_DEC_BCJ) || defined(XZ_DEC_DELTA)
+	uint8_t filters;
+	uint8_t id;
+#endif
 
 	/*
 	 * Validate the CRC32. We know that the temp buffer is at least
@@ -509,10 +646,13 @@ static enum xz_ret dec_block_header(struct xz_dec *s)
 	s->temp.pos = 2;
 
 	/*
-	 * Catch unsupported Block Flags. We support only one or two filters
-	 * in the chain, so we catch that with the same test.
+	 * Catch unsupported Block Flags. We support only one, two, or
+	 * three filters in the chain depending on which filters have been
+	 * enabled, so we catch that with the same test.
 	 */
-#ifdef XZ_DEC_BCJ
+#if defined(XZ_DEC_BCJ) && defined(XZ_DEC_DELTA)
+	if (s->temp.buf[1] & 0x3C)
+#elif defined(XZ_DEC_BCJ) || defined(XZ_DEC_DELTA)
 	if (s->temp.buf[1] & 0x3E)
 #else
 	if (s->temp.buf[1] & 0x3F)
@@ -542,22 +682,65 @@ static enum xz_ret dec_block_header(struct xz_dec *s)
 	}
 
 #ifdef XZ_DEC_BCJ
-	/* If there are two filters, the first one must be a BCJ filter. */
-	s->bcj_active = s->temp.buf[1] & 0x01;
-	if (s->bcj_active) {
+	s->bcj_active = false;
+#endif
+#ifdef XZ_DEC_DELTA
+	s->delta_active = false;
+#endif
+
+#if defined(XZ_DEC_BCJ) || defined(XZ_DEC_DELTA)
+	/*
+	 * The supported chains are BCJ + LZMA2, Delta + LZMA2, and
+	 * BCJ + Delta + LZMA2. That is, a BCJ filter may only be the first
+	 * filter and Delta may only be right before LZMA2.
+	 */
+	filters = s->temp.buf[1] & 0x03;
+	while (filters-- > 0) {
 		if (s->temp.size - s->temp.pos < 2)
 			return XZ_OPTIONS_ERROR;
 
-		ret = xz_dec_bcj_reset(s->bcj, s->temp.buf[s->temp.pos++]);
-		if (ret != XZ_OK)
-			return ret;
+		id = s->temp.buf[s->temp.pos++];
 
-		/*
-		 * We don't support custom start offset,
-		 * so Size of Properties must be zero.
-		 */
-		if (s->temp.buf[s->temp.pos++] != 0x00)
-			return XZ_OPTIONS_ERROR;
+#ifdef XZ_DEC_DELTA
+		if (id == 0x03 && filters == 0) {
+			/* Size of Properties = 1-byte Filter Properties */
+			if (s->temp.buf[s->temp.pos++] != 0x01)
+				return XZ_OPTIONS_ERROR;
+
+			/*
+			 * Filter Properties contains the distance. Like
+			 * above, a truncated Filter Flags field is reported
+			 * as an unsupported filter chain.
+			 */
+			if (s->temp.size - s->temp.pos < 1)
+				return XZ_OPTIONS_ERROR;
+
+			xz_dec_delta_reset(s->delta,
+					   s->temp.buf[s->temp.pos++]);
+			s->delta_active = true;
+			continue;
+		}
+#endif
+
+#ifdef XZ_DEC_BCJ
+		if (!s->bcj_active) {
+			ret = xz_dec_bcj_reset(s->bcj, id);
+			if (ret != XZ_OK)
+				return ret;
+
+			/*
+			 * We don't support custom start offset,
+			 * so Size of Properties must be zero.
+			 */
+			if (s->temp.buf[s->temp.pos++] != 0x00)
+				return XZ_OPTIONS_ERROR;
+
+			s->bcj_active = true;
+			continue;
+		}
+#endif
+
+		return XZ_OPTIONS_ERROR;
 	}
 #endif
 
@@ -627,6 +810,17 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 			s->sequence = SEQ_BLOCK_START;
 
 			ret = dec_stream_header(s);
+			if (ret == XZ_OK || ret == XZ_UNSUPPORTED_CHECK)
+				XZ_TRACE(stream_header, s->check_type);
+
+#ifdef XZ_DEC_EVENTS
+			if (ret == XZ_OK || ret == XZ_UNSUPPORTED_CHECK) {
+				s->block_in = s->stream_in + STREAM_HEADER_SIZE;
+				event(s, XZ_EVENT_STREAM_START, s->stream_in,
+				      s->stream_out, XZ_SIZE_UNKNOWN,
+				      XZ_SIZE_UNKNOWN);
+			}
+#endif
 			if (ret != XZ_OK)
 				return ret;
 
@@ -665,17 +859,32 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 			if (ret != XZ_OK)
 				return ret;
 
+			XZ_TRACE(block_start, s->block_header.size,
+				 s->block_header.compressed,
+				 s->block_header.uncompressed);
+
 #ifdef XZ_USE_SHA256
 			if (s->check_type == XZ_CHECK_SHA256)
 				xz_sha256_reset(&s->sha256);
 #endif
 
+#ifdef XZ_DEC_EVENTS
+			event(s, XZ_EVENT_BLOCK_START, s->block_in,
+			      s->stream_out + s->block.hash.uncompressed,
+			      XZ_SIZE_UNKNOWN, XZ_SIZE_UNKNOWN);
+#endif
+
 			s->sequence = SEQ_BLOCK_UNCOMPRESS;
 
 			fallthrough;
 
 		case SEQ_BLOCK_UNCOMPRESS:
-			ret = dec_block(s, b);
+#ifdef XZ_DEC_SKIP
+			if (s->skip > 0 && DEC_IS_MULTI(s->mode))
+				ret = dec_block_skip(s, b);
+			else
+#endif
+				ret = dec_block(s, b);
 			if (ret != XZ_STREAM_END)
 				return ret;
 
@@ -701,6 +910,7 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 				++s->block.compressed;
 			}
 
+			XZ_TRACE(block_check, s->check_type);
 			s->sequence = SEQ_BLOCK_CHECK;
 
 			fallthrough;
@@ -735,6 +945,20 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 			}
 #endif
 
+#ifdef XZ_DEC_EVENTS
+			/* s->block.compressed includes Block Padding now. */
+			event(s, XZ_EVENT_BLOCK_END, s->block_in,
+			      s->stream_out + s->block.hash.uncompressed
+				- s->block.uncompressed,
+			      s->block_header.size + s->block.compressed
+				+ check_size(s),
+			      s->block.uncompressed);
+			s->block_in += s->block_header.size
+					+ s->block.compressed + check_size(s);
+#endif
+
+			XZ_TRACE(block_end, s->block.compressed,
+				 s->block.uncompressed);
 			s->sequence = SEQ_BLOCK_START;
 			break;
 
@@ -785,7 +1009,24 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 			if (!fill_temp(s, b))
 				return XZ_OK;
 
+#ifdef XZ_DEC_EVENTS
+			ret = dec_stream_footer(s);
+			if (ret == XZ_STREAM_END) {
+				/* The Index CRC32 isn't in s->index.size. */
+				s->block_in += s->index.size + 4
+						+ STREAM_HEADER_SIZE;
+				event(s, XZ_EVENT_STREAM_END, s->stream_in,
+				      s->stream_out,
+				      s->block_in - s->stream_in,
+				      s->block.hash.uncompressed);
+				s->stream_in = s->block_in;
+				s->stream_out += s->block.hash.uncompressed;
+			}
+
+			return ret;
+#else
 			return dec_stream_footer(s);
+#endif
 
 		case SEQ_STREAM_PADDING:
 			/* Never reached, only silencing a warning */
@@ -796,6 +1037,23 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 	/* Never reached */
 }
 
+/*
+ * Prepare to decode a new Stream. Unlike xz_dec_reset(), this keeps the
+ * state that xz_dec_catrun() carries from one Stream to the next: the
+ * amount still to be skipped and the offsets for the events.
+ */
+static void stream_reset(struct xz_dec *s)
+{
+	s->sequence = SEQ_STREAM_HEADER;
+	s->allow_buf_error = false;
+	s->pos = 0;
+	s->crc = 0;
+	memzero(&s->block, sizeof(s->block));
+	memzero(&s->index, sizeof(s->index));
+	s->temp.pos = 0;
+	s->temp.size = STREAM_HEADER_SIZE;
+}
+
 /*
  * xz_dec_run() is a wrapper for dec_main() to handle some special cases in
  * multi-call and single-call decoding.
@@ -820,18 +1078,24 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
  * be any valid uncompressed data in the output buffer unless the decoding
  * actually succeeds (that's the price to pay of using the output buffer as
  * the workspace).
+ *
+ * dec_run() does all this except resetting the state in single-call mode
+ * so that xz_dec_catrun() can keep the state that spans multiple Streams.
  */
-XZ_EXTERN enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b)
+static enum xz_ret dec_run(struct xz_dec *s, struct xz_buf *b)
 {
 	size_t in_start;
 	size_t out_start;
+#ifdef XZ_DEC_SKIP
+	uint64_t skip_start;
+#endif
 	enum xz_ret ret;
 
-	if (DEC_IS_SINGLE(s->mode))
-		xz_dec_reset(s);
-
 	in_start = b->in_pos;
 	out_start = b->out_pos;
+#ifdef XZ_DEC_SKIP
+	skip_start = s->skip;
+#endif
 	ret = dec_main(s, b);
 
 	if (DEC_IS_SINGLE(s->mode)) {
@@ -845,7 +1109,11 @@ XZ_EXTERN enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b)
 		}
 
 	} else if (ret == XZ_OK && in_start == b->in_pos
-			&& out_start == b->out_pos) {
+			&& out_start == b->out_pos
+#ifdef XZ_DEC_SKIP
+			&& skip_start == s->skip
+#endif
+			) {
 		if (s->allow_buf_error)
 			ret = XZ_BUF_ERROR;
 
@@ -857,6 +1125,14 @@ XZ_EXTERN enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b)
 	return ret;
 }
 
+XZ_EXTERN enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b)
+{
+	if (DEC_IS_SINGLE(s->mode))
+		xz_dec_reset(s);
+
+	return dec_run(s, b);
+}
+
 #ifdef XZ_DEC_CONCATENATED
 XZ_EXTERN enum xz_ret xz_dec_catrun(struct xz_dec *s, struct xz_buf *b,
 				    int finish)
@@ -905,20 +1181,22 @@ XZ_EXTERN enum xz_ret xz_dec_catrun(struct xz_dec *s, struct xz_buf *b,
 
 				++b->in_pos;
 				s->pos = (s->pos + 1) & 3;
+#ifdef XZ_DEC_EVENTS
+				++s->stream_in;
+#endif
 			}
 
 			/*
 			 * More input remains. It should be a new Stream.
 			 *
-			 * In single-call mode xz_dec_run() will always call
-			 * xz_dec_reset(). Thus, we need to do it here only
-			 * in multi-call mode.
+			 * dec_run() doesn't reset the decoder in single-call
+			 * mode like xz_dec_run() does. The offsets for the
+			 * events continue to the new Stream in both modes.
 			 */
-			if (DEC_IS_MULTI(s->mode))
-				xz_dec_reset(s);
+			stream_reset(s);
 		}
 
-		ret = xz_dec_run(s, b);
+		ret = dec_run(s, b);
 
 		if (ret != XZ_STREAM_END)
 			break;
@@ -930,6 +1208,37 @@ XZ_EXTERN enum xz_ret xz_dec_catrun(struct xz_dec *s, struct xz_buf *b,
 }
 #endif
 
+#ifdef XZ_DEC_IOV
+XZ_EXTERN enum xz_ret xz_dec_run_iov(struct xz_dec *s, struct xz_buf_iov *v)
+{
+	struct xz_buf b;
+	bool advanced = false;
+	enum xz_ret ret;
+
+	if (DEC_IS_SINGLE(s->mode))
+		return XZ_OPTIONS_ERROR;
+
+	while (true) {
+		xz_iov_load(v, &b);
+		ret = dec_run(s, &b);
+		if (!xz_iov_store(v, &b) || ret != XZ_OK)
+			break;
+
+		advanced = true;
+	}
+
+	/*
+	 * If a segment was used up, progress was made even if the decoder
+	 * couldn't do anything with the next segments. Don't let the last
+	 * dec_run() call count towards XZ_BUF_ERROR.
+	 */
+	if (advanced)
+		s->allow_buf_error = false;
+
+	return ret;
+}
+#endif
+
 XZ_EXTERN struct xz_dec *xz_dec_init(enum xz_mode mode, uint32_t dict_max)
 {
 	struct xz_dec *s = kmalloc(sizeof(*s), GFP_KERNEL);
@@ -944,14 +1253,28 @@ XZ_EXTERN struct xz_dec *xz_dec_init(enum xz_mode mode, uint32_t dict_max)
 		goto error_bcj;
 #endif
 
+#ifdef XZ_DEC_DELTA
+	s->delta = xz_dec_delta_create(DEC_IS_SINGLE(mode));
+	if (s->delta == NULL)
+		goto error_delta;
+#endif
+
 	s->lzma2 = xz_dec_lzma2_create(mode, dict_max);
 	if (s->lzma2 == NULL)
 		goto error_lzma2;
 
+#ifdef XZ_DEC_EVENTS
+	s->event_cb = NULL;
+#endif
+
 	xz_dec_reset(s);
 	return s;
 
 error_lzma2:
+#ifdef XZ_DEC_DELTA
+	xz_dec_delta_end(s->delta);
+error_delta:
+#endif
 #ifdef XZ_DEC_BCJ
 	xz_dec_bcj_end(s->bcj);
 error_bcj:
@@ -960,25 +1283,627 @@ error_bcj:
 	return NULL;
 }
 
+XZ_EXTERN uint64_t xz_dec_memusage(enum xz_mode mode, uint32_t dict_max)
+{
+	uint64_t size = sizeof(struct xz_dec)
+			+ xz_dec_lzma2_memusage(mode, dict_max);
+
+#ifdef XZ_DEC_BCJ
+	size += xz_dec_bcj_memusage();
+#endif
+#ifdef XZ_DEC_DELTA
+	size += xz_dec_delta_memusage();
+#endif
+
+	return size;
+}
+
+XZ_EXTERN uint64_t xz_dec_memusage_of(const struct xz_dec *s)
+{
+	uint64_t size = sizeof(struct xz_dec)
+			+ xz_dec_lzma2_memusage_of(s->lzma2);
+
+#ifdef XZ_DEC_BCJ
+	size += xz_dec_bcj_memusage();
+#endif
+#ifdef XZ_DEC_DELTA
+	size += xz_dec_delta_memusage();
+#endif
+
+	return size;
+}
+
+XZ_EXTERN uint64_t xz_dec_memusage_peak(const struct xz_dec *s)
+{
+	return xz_dec_memusage_of(s) - xz_dec_lzma2_memusage_of(s->lzma2)
+			+ xz_dec_lzma2_memusage_peak(s->lzma2);
+}
+
 XZ_EXTERN void xz_dec_reset(struct xz_dec *s)
 {
-	s->sequence = SEQ_STREAM_HEADER;
-	s->allow_buf_error = false;
-	s->pos = 0;
-	s->crc = 0;
-	memzero(&s->block, sizeof(s->block));
-	memzero(&s->index, sizeof(s->index));
-	s->temp.pos = 0;
-	s->temp.size = STREAM_HEADER_SIZE;
+	stream_reset(s);
+	xz_dec_lzma2_reset_peak(s->lzma2);
+#ifdef XZ_DEC_SKIP
+	s->skip = 0;
+#endif
+#ifdef XZ_DEC_EVENTS
+	s->stream_in = 0;
+	s->stream_out = 0;
+#endif
+#ifdef XZ_DEC_STATS
+	memzero(xz_dec_lzma2_stats(s->lzma2), sizeof(struct xz_dec_stats));
+#endif
+}
+
+#ifdef XZ_DEC_SAVE
+/*
+ * The saved state begins with a header of SAVE_HEADER_SIZE bytes: four
+ * magic bytes and the sizes of the four parts that follow as 32-bit little
+ * endian integers. The parts are struct xz_dec and the states of the LZMA2,
+ * BCJ, and Delta decoders. The last three are empty unless a Block is being
+ * decoded and the filter is used in it. The last four bytes are the CRC32
+ * of everything before them.
+ */
+#define SAVE_HEADER_SIZE 20
+#define SAVE_PARTS 4
+
+static const uint8_t save_magic[4] = { 'X', 'Z', 'd', 's' };
+
+/* Get the sizes of the parts of the saved state. */
+static void save_sizes(const struct xz_dec *s, size_t sizes[SAVE_PARTS])
+{
+	sizes[0] = sizeof(*s);
+	sizes[1] = 0;
+	sizes[2] = 0;
+	sizes[3] = 0;
+
+	if (s->sequence == SEQ_BLOCK_UNCOMPRESS) {
+		sizes[1] = xz_dec_lzma2_save_size(s->lzma2);
+#ifdef XZ_DEC_BCJ
+		if (s->bcj_active)
+			sizes[2] = xz_dec_bcj_memusage();
+#endif
+#ifdef XZ_DEC_DELTA
+		if (s->delta_active)
+			sizes[3] = xz_dec_delta_memusage();
+#endif
+	}
+}
+
+XZ_EXTERN size_t xz_dec_save_size(const struct xz_dec *s)
+{
+	size_t sizes[SAVE_PARTS];
+	size_t size = SAVE_HEADER_SIZE + 4;
+	size_t i;
+
+	save_sizes(s, sizes);
+	for (i = 0; i < SAVE_PARTS; ++i)
+		size += sizes[i];
+
+	return size;
+}
+
+XZ_EXTERN enum xz_ret xz_dec_save(const struct xz_dec *s, uint8_t *buf,
+				  size_t size)
+{
+	size_t sizes[SAVE_PARTS];
+	size_t pos;
+	size_t i;
+
+	if (DEC_IS_SINGLE(s->mode))
+		return XZ_OPTIONS_ERROR;
+
+	if (size < xz_dec_save_size(s))
+		return XZ_BUF_ERROR;
+
+	save_sizes(s, sizes);
+
+	memcpy(buf, save_magic, sizeof(save_magic));
+	for (i = 0; i < SAVE_PARTS; ++i)
+		put_unaligned_le32((uint32_t)sizes[i], buf + 4 + 4 * i);
+
+	pos = SAVE_HEADER_SIZE;
+	memcpy(buf + pos, s, sizes[0]);
+	pos += sizes[0];
+
+	if (sizes[1] > 0)
+		xz_dec_lzma2_save(s->lzma2, buf + pos);
+
+	pos += sizes[1];
+
+#ifdef XZ_DEC_BCJ
+	if (sizes[2] > 0)
+		xz_dec_bcj_save(s->bcj, buf + pos);
+
+	pos += sizes[2];
+#endif
+
+#ifdef XZ_DEC_DELTA
+	if (sizes[3] > 0)
+		xz_dec_delta_save(s->delta, buf + pos);
+
+	pos += sizes[3];
+#endif
+
+	put_unaligned_le32(xz_crc32(buf, pos, 0), buf + pos);
+	return XZ_OK;
 }
 
+XZ_EXTERN enum xz_ret xz_dec_restore(struct xz_dec *s, const uint8_t *buf,
+				     size_t size)
+{
+	/* These belong to this decoder, not to the saved one. */
+	struct xz_dec_lzma2 *lzma2 = s->lzma2;
+#ifdef XZ_DEC_BCJ
+	struct xz_dec_bcj *bcj = s->bcj;
+#endif
+#ifdef XZ_DEC_DELTA
+	struct xz_dec_delta *delta = s->delta;
+#endif
+#ifdef XZ_DEC_EVENTS
+	void (*event_cb)(void *opaque, const struct xz_event *event)
+			= s->event_cb;
+	void *event_opaque = s->event_opaque;
+#endif
+	enum xz_mode mode = s->mode;
+
+	size_t sizes[SAVE_PARTS];
+	size_t pos;
+	size_t i;
+	enum xz_ret ret;
+
+	if (DEC_IS_SINGLE(s->mode))
+		return XZ_OPTIONS_ERROR;
+
+	if (size < SAVE_HEADER_SIZE + 4
+			|| !memeq(buf, save_magic, sizeof(save_magic)))
+		return XZ_FORMAT_ERROR;
+
+	pos = SAVE_HEADER_SIZE;
+	for (i = 0; i < SAVE_PARTS; ++i) {
+		sizes[i] = get_unaligned_le32(buf + 4 + 4 * i);
+		if (sizes[i] > size - 4 - pos)
+			return XZ_DATA_ERROR;
+
+		pos += sizes[i];
+	}
+
+	if (pos != size - 4 || xz_crc32(buf, pos, 0)
+			!= get_unaligned_le32(buf + pos))
+		return XZ_DATA_ERROR;
+
+	/*
+	 * The state can be restored only with the same build of XZ Embedded
+	 * because the structures are copied as is.
+	 */
+	if (sizes[0] != sizeof(*s))
+		return XZ_OPTIONS_ERROR;
+
+#ifdef XZ_DEC_BCJ
+	if (sizes[2] != 0 && sizes[2] != xz_dec_bcj_memusage())
+		return XZ_OPTIONS_ERROR;
+#else
+	if (sizes[2] != 0)
+		return XZ_OPTIONS_ERROR;
+#endif
+
+#ifdef XZ_DEC_DELTA
+	if (sizes[3] != 0 && sizes[3] != xz_dec_delta_memusage())
+		return XZ_OPTIONS_ERROR;
+#else
+	if (sizes[3] != 0)
+		return XZ_OPTIONS_ERROR;
+#endif
+
+	pos = SAVE_HEADER_SIZE;
+	memcpy(s, buf + pos, sizes[0]);
+	pos += sizes[0];
+
+	s->lzma2 = lzma2;
+#ifdef XZ_DEC_BCJ
+	s->bcj = bcj;
+#endif
+#ifdef XZ_DEC_DELTA
+	s->delta = delta;
+#endif
+#ifdef XZ_DEC_EVENTS
+	s->event_cb = event_cb;
+	s->event_opaque = event_opaque;
+#endif
+	s->mode = mode;
+
+#if defined(XZ_USE_SHA256) && defined(XZ_SIMD_SHA)
+	/* The processor may be different now. */
+	s->sha256.sha_ext = xz_cpu_has(XZ_CPU_SHA);
+#endif
+
+	/* The parts must match what save_sizes() would have given. */
+	ret = XZ_DATA_ERROR;
+
+	if (s->temp.size > sizeof(s->temp.buf) || s->temp.pos > s->temp.size)
+		goto error;
+
+	if ((s->sequence == SEQ_BLOCK_UNCOMPRESS) != (sizes[1] > 0))
+		goto error;
+
+	if (sizes[1] == 0 && (sizes[2] > 0 || sizes[3] > 0))
+		goto error;
+
+#ifdef XZ_DEC_BCJ
+	if (sizes[1] > 0 && s->bcj_active != (sizes[2] > 0))
+		goto error;
+#endif
+
+#ifdef XZ_DEC_DELTA
+	if (sizes[1] > 0 && s->delta_active != (sizes[3] > 0))
+		goto error;
+#endif
+
+	if (sizes[1] > 0) {
+		ret = xz_dec_lzma2_restore(s->lzma2, buf + pos, sizes[1]);
+		if (ret != XZ_OK)
+			goto error;
+
+		pos += sizes[1];
+	}
+
+#ifdef XZ_DEC_BCJ
+	if (sizes[2] > 0) {
+		ret = xz_dec_bcj_restore(s->bcj, buf + pos);
+		if (ret != XZ_OK)
+			goto error;
+
+		pos += sizes[2];
+	}
+#endif
+
+#ifdef XZ_DEC_DELTA
+	if (sizes[3] > 0) {
+		ret = xz_dec_delta_restore(s->delta, buf + pos);
+		if (ret != XZ_OK)
+			goto error;
+	}
+#endif
+
+	return XZ_OK;
+
+error:
+	xz_dec_reset(s);
+	return ret;
+}
+#endif
+
+#ifdef XZ_DEC_EVENTS
+XZ_EXTERN void xz_dec_set_event_cb(struct xz_dec *s,
+		void (*cb)(void *opaque, const struct xz_event *event),
+		void *opaque)
+{
+	s->event_cb = cb;
+	s->event_opaque = opaque;
+}
+#endif
+
+#ifdef XZ_DEC_FLUSH
+XZ_EXTERN void xz_dec_set_flush(struct xz_dec *s, int flush)
+{
+	if (DEC_IS_MULTI(s->mode))
+		xz_dec_lzma2_set_flush(s->lzma2, flush != 0);
+}
+
+XZ_EXTERN size_t xz_dec_held(const struct xz_dec *s)
+{
+	size_t held;
+
+	if (DEC_IS_SINGLE(s->mode) || s->sequence != SEQ_BLOCK_UNCOMPRESS)
+		return 0;
+
+	held = xz_dec_lzma2_held(s->lzma2);
+#ifdef XZ_DEC_BCJ
+	if (s->bcj_active)
+		held += xz_dec_bcj_held(s->bcj);
+#endif
+
+	return held;
+}
+#endif
+
+#ifdef XZ_DEC_STATS
+XZ_EXTERN void xz_dec_get_stats(const struct xz_dec *s,
+				struct xz_dec_stats *stats)
+{
+	*stats = *xz_dec_lzma2_stats(s->lzma2);
+}
+#endif
+
+#ifdef XZ_DEC_SKIP
+XZ_EXTERN uint64_t xz_dec_skip(struct xz_dec *s, uint64_t size)
+{
+	if (size > XZ_SKIP_ALL - s->skip)
+		s->skip = XZ_SKIP_ALL;
+	else
+		s->skip += size;
+
+	return s->skip;
+}
+#endif
+
 XZ_EXTERN void xz_dec_end(struct xz_dec *s)
 {
 	if (s != NULL) {
 		xz_dec_lzma2_end(s->lzma2);
+#ifdef XZ_DEC_DELTA
+		xz_dec_delta_end(s->delta);
+#endif
 #ifdef XZ_DEC_BCJ
 		xz_dec_bcj_end(s->bcj);
 #endif
 		kfree(s);
 	}
 }
+
+#ifdef XZ_DEC_PROBE
+/*
+ * Decode a variable-length integer from buf[*pos] when all of it is
+ * in the buffer. Return false if it is truncated or invalid.
+ */
+static bool probe_vli(const uint8_t *buf, size_t *pos, size_t size,
+		      vli_type *vli)
+{
+	uint32_t shift = 0;
+	uint8_t byte;
+
+	*vli = 0;
+
+	do {
+		if (*pos >= size || shift == 7 * VLI_BYTES_MAX)
+			return false;
+
+		byte = buf[(*pos)++];
+		*vli |= (vli_type)(byte & 0x7F) << shift;
+
+		/* Don't allow non-minimal encodings. */
+		if (byte == 0 && shift != 0)
+			return false;
+
+		shift += 7;
+	} while (byte & 0x80);
+
+	return true;
+}
+
+/*
+ * Decode the Filter Flags of the first Block Header like
+ * dec_block_header() but only store the information into info.
+ */
+static enum xz_ret probe_block_header(const uint8_t *buf, size_t size,
+				      struct xz_info *info)
+{
+	size_t pos = 2;
+	vli_type vli;
+	uint8_t filters;
+	uint8_t id;
+	uint8_t props;
+
+	if (xz_crc32(buf, size, 0) != get_le32(buf + size))
+		return XZ_DATA_ERROR;
+
+	if (buf[1] & 0x3C)
+		return XZ_OPTIONS_ERROR;
+
+	if (buf[1] & 0x40) {
+		if (!probe_vli(buf, &pos, size, &vli))
+			return XZ_DATA_ERROR;
+
+		info->block_compressed = vli;
+	}
+
+	if (buf[1] & 0x80) {
+		if (!probe_vli(buf, &pos, size, &vli))
+			return XZ_DATA_ERROR;
+
+		info->block_uncompressed = vli;
+	}
+
+	/* Only BCJ + Delta + LZMA2 and its subsets are supported. */
+	filters = buf[1] & 0x03;
+	while (filters-- > 0) {
+		if (size - pos < 2)
+			return XZ_OPTIONS_ERROR;
+
+		id = buf[pos++];
+		props = buf[pos++];
+
+		if (id == 0x03) {
+			if (props != 0x01)
+				return XZ_OPTIONS_ERROR;
+
+			if (size - pos < 1)
+				return XZ_DATA_ERROR;
+
+			info->delta_distance = (uint32_t)buf[pos++] + 1;
+#ifdef XZ_DEC_DELTA
+			if (filters == 0)
+				continue;
+#endif
+			return XZ_OPTIONS_ERROR;
+		}
+
+		if (info->bcj_id != 0 || info->delta_distance != 0)
+			return XZ_OPTIONS_ERROR;
+
+		info->bcj_id = id;
+
+#ifdef XZ_DEC_BCJ
+		if (!xz_dec_bcj_supported(id))
+#endif
+			return XZ_OPTIONS_ERROR;
+
+		/* Custom start offset isn't supported. */
+		if (props != 0x00)
+			return XZ_OPTIONS_ERROR;
+	}
+
+	if (size - pos < 2)
+		return XZ_DATA_ERROR;
+
+	if (buf[pos++] != 0x21)
+		return XZ_OPTIONS_ERROR;
+
+	if (buf[pos++] != 0x01)
+		return XZ_OPTIONS_ERROR;
+
+	if (size - pos < 1)
+		return XZ_DATA_ERROR;
+
+	/* The same limit and calculation as in xz_dec_lzma2_reset() */
+	props = buf[pos++];
+	if (props > 39)
+		return XZ_OPTIONS_ERROR;
+
+	info->dict_size = (2 + (uint32_t)(props & 1)) << ((props >> 1) + 11);
+
+	while (pos < size)
+		if (buf[pos++] != 0x00)
+			return XZ_OPTIONS_ERROR;
+
+	return XZ_OK;
+}
+
+XZ_EXTERN enum xz_ret xz_probe(const uint8_t *buf, size_t len,
+			       struct xz_info *info)
+{
+	size_t size;
+
+	memzero(info, sizeof(*info));
+	info->block_compressed = XZ_SIZE_UNKNOWN;
+	info->block_uncompressed = XZ_SIZE_UNKNOWN;
+	info->index_size = XZ_SIZE_UNKNOWN;
+	info->stream_compressed = XZ_SIZE_UNKNOWN;
+	info->stream_uncompressed = XZ_SIZE_UNKNOWN;
+	info->stream_blocks = XZ_SIZE_UNKNOWN;
+
+	if (!memeq(buf, HEADER_MAGIC, min_t(size_t, len, HEADER_MAGIC_SIZE)))
+		return XZ_FORMAT_ERROR;
+
+	if (len < STREAM_HEADER_SIZE)
+		return XZ_BUF_ERROR;
+
+	/* Stream Flags like in dec_stream_header() */
+	if (xz_crc32(buf + HEADER_MAGIC_SIZE, 2, 0)
+			!= get_le32(buf + HEADER_MAGIC_SIZE + 2))
+		return XZ_DATA_ERROR;
+
+	if (buf[HEADER_MAGIC_SIZE] != 0
+			|| buf[HEADER_MAGIC_SIZE + 1] > XZ_CHECK_MAX)
+		return XZ_OPTIONS_ERROR;
+
+	info->check = buf[HEADER_MAGIC_SIZE + 1];
+
+#ifndef XZ_DEC_ANY_CHECK
+	if (info->check > XZ_CHECK_CRC32 && !IS_CRC64(info->check)
+			&& !IS_SHA256(info->check))
+		return XZ_OPTIONS_ERROR;
+#endif
+
+	buf += STREAM_HEADER_SIZE;
+	len -= STREAM_HEADER_SIZE;
+
+	if (len < 1)
+		return XZ_BUF_ERROR;
+
+	/* Index Indicator means that there are no Blocks. */
+	if (buf[0] == 0x00)
+		return XZ_OK;
+
+	size = ((size_t)buf[0] + 1) * 4;
+	if (len < size)
+		return XZ_BUF_ERROR;
+
+	return probe_block_header(buf, size - 4, info);
+}
+
+XZ_EXTERN enum xz_ret xz_probe_tail(const uint8_t *buf, size_t len,
+				    struct xz_info *info)
+{
+	const uint8_t *footer;
+	const uint8_t *index;
+	size_t pos;
+	vli_type count;
+	vli_type unpadded;
+	vli_type uncompressed;
+	vli_type blocks_size = 0;
+	vli_type uncompressed_size = 0;
+
+	/* Skip Stream Padding. */
+	while (len >= 4 && get_le32(buf + len - 4) == 0)
+		len -= 4;
+
+	if (len < STREAM_HEADER_SIZE)
+		return XZ_BUF_ERROR;
+
+	/* Stream Footer like in dec_stream_footer() */
+	footer = buf + len - STREAM_HEADER_SIZE;
+	if (!memeq(footer + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE))
+		return XZ_FORMAT_ERROR;
+
+	if (xz_crc32(footer + 4, 6, 0) != get_le32(footer))
+		return XZ_DATA_ERROR;
+
+	if (footer[8] != 0 || footer[9] > XZ_CHECK_MAX)
+		return XZ_OPTIONS_ERROR;
+
+	info->index_size = ((vli_type)get_le32(footer + 4) + 1) * 4;
+	if (len - STREAM_HEADER_SIZE < info->index_size)
+		return XZ_BUF_ERROR;
+
+	/*
+	 * The smallest Index has the Index Indicator, Number of Records,
+	 * two bytes of Index Padding, and the CRC32.
+	 */
+	if (info->index_size < 8)
+		return XZ_DATA_ERROR;
+
+	/*
+	 * The Index: Index Indicator, Number of Records, the Records,
+	 * Index Padding, and CRC32
+	 */
+	index = footer - info->index_size;
+	pos = 1;
+
+	if (index[0] != 0x00 || !probe_vli(index, &pos,
+					   info->index_size - 4, &count))
+		return XZ_DATA_ERROR;
+
+	info->stream_blocks = count;
+
+	while (count-- > 0) {
+		if (!probe_vli(index, &pos, info->index_size - 4, &unpadded)
+				|| !probe_vli(index, &pos,
+					      info->index_size - 4,
+					      &uncompressed)
+				|| unpadded == 0 || unpadded > VLI_MAX
+				|| uncompressed > VLI_MAX)
+			return XZ_DATA_ERROR;
+
+		blocks_size += (unpadded + 3) & ~(vli_type)3;
+		uncompressed_size += uncompressed;
+
+		if (blocks_size > VLI_MAX || uncompressed_size > VLI_MAX)
+			return XZ_DATA_ERROR;
+	}
+
+	while (pos & 3)
+		if (index[pos++] != 0x00)
+			return XZ_DATA_ERROR;
+
+	if (pos != info->index_size - 4 || xz_crc32(index, pos, 0)
+			!= get_le32(index + pos))
+		return XZ_DATA_ERROR;
+
+	info->stream_compressed = 2 * STREAM_HEADER_SIZE + blocks_size
+			+ info->index_size;
+	info->stream_uncompressed = uncompressed_size;
+
+	return XZ_OK;
+}
+#endif
@@ -9,10 +9,16 @@
 #include <linux/module.h>
 #include <linux/xz.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/xz.h>
+
 EXPORT_SYMBOL(xz_dec_init);
 EXPORT_SYMBOL(xz_dec_reset);
 EXPORT_SYMBOL(xz_dec_run);
 EXPORT_SYMBOL(xz_dec_end);
+EXPORT_SYMBOL(xz_dec_memusage);
+EXPORT_SYMBOL(xz_dec_memusage_of);
+EXPORT_SYMBOL(xz_dec_memusage_peak);
 
 #ifdef CONFIG_XZ_DEC_MICROLZMA
 EXPORT_SYMBOL(xz_dec_microlzma_alloc);
@@ -21,6 +27,13 @@ EXPORT_SYMBOL(xz_dec_microlzma_run);
 EXPORT_SYMBOL(xz_dec_microlzma_end);
 #endif
 
+#ifdef CONFIG_XZ_DEC_IOV
+EXPORT_SYMBOL(xz_dec_run_iov);
+#ifdef CONFIG_XZ_DEC_MICROLZMA
+EXPORT_SYMBOL(xz_dec_microlzma_run_iov);
+#endif
+#endif
+
 MODULE_DESCRIPTION("XZ decompressor");
 MODULE_VERSION("1.2");
 MODULE_AUTHOR("Lasse Collin <lasse.collin@tukaani.org> and Igor Pavlov");
@@ -3,19 +3,48 @@
 /*
  * XZ decoder tester
  *
+ * To measure the decoder, load the module for example with
+ * "modprobe xz_dec_test mode=prealloc buf_size=131072", write a .xz
+ * file to the device, and then read the device.
+ *
  * Author: Lasse Collin <lasse.collin@tukaani.org>
  */
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
 #include <linux/xz.h>
 
 /* Maximum supported dictionary size */
 #define DICT_MAX (1 << 20)
 
+/*
+ * Decoder mode: "single", "prealloc", or "dynalloc". In single-call mode
+ * the whole input is collected into buffer_in and decoded when the device
+ * is closed, so buf_size must be big enough for both the .xz file and
+ * the uncompressed data.
+ */
+static char *mode = "prealloc";
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "Decoder mode: single, prealloc, or dynalloc");
+
+/*
+ * Size of each of the input and output buffers. Big buffers mean fewer
+ * calls to xz_dec_run() and fewer copy_from_user() calls per write().
+ */
+static unsigned int buf_size = 1024;
+module_param(buf_size, uint, 0444);
+MODULE_PARM_DESC(buf_size, "Size of the input and output buffers");
+
+static enum xz_mode dec_mode;
+
 /* Device name to pass to register_chrdev(). */
 #define DEVICE_NAME "xz_dec_test"
 
@@ -24,10 +53,17 @@ static int device_major;
 
 /*
  * We reuse the same decoder state, and thus can decode only one
- * file at a time.
+ * file at a time. The device can be opened for reading at any time
+ * to get the statistics of the latest file.
  */
 static bool device_is_open;
 
+/*
+ * Protects device_is_open and everything below because the statistics
+ * can be read while a file is being decoded.
+ */
+static DEFINE_MUTEX(lock);
+
 /* XZ decoder state */
 static struct xz_dec *state;
 
@@ -38,21 +74,14 @@ static struct xz_dec *state;
 static enum xz_ret ret;
 
 /*
- * Input and output buffers. The input buffer is used as a temporary safe
- * place for the data coming from the userspace.
+ * Input and output buffers of buf_size bytes. The input buffer is used
+ * as a temporary safe place for the data coming from the userspace.
  */
-static uint8_t buffer_in[1024];
-static uint8_t buffer_out[1024];
+static uint8_t *buffer_in;
+static uint8_t *buffer_out;
 
-/*
- * Structure to pass the input and output buffers to the XZ decoder.
- * A few of the fields are never modified so we initialize them here.
- */
-static struct xz_buf buffers = {
-	.in = buffer_in,
-	.out = buffer_out,
-	.out_size = sizeof(buffer_out)
-};
+/* Structure to pass the input and output buffers to the XZ decoder. */
+static struct xz_buf buffers;
 
 /*
  * CRC32 of uncompressed data. This is used to give the user a simple way
@@ -60,10 +89,87 @@ static struct xz_buf buffers = {
  */
 static uint32_t crc;
 
+/*
+ * Statistics of the current or the latest file. Only the time spent in
+ * xz_dec_run() is counted, not copy_from_user() or crc32().
+ */
+static uint64_t in_bytes;
+static uint64_t out_bytes;
+static uint64_t calls;
+static uint64_t decode_ns;
+
+static const char *const ret_names[] = {
+	"XZ_OK",
+	"XZ_STREAM_END",
+	"XZ_UNSUPPORTED_CHECK",
+	"XZ_MEM_ERROR",
+	"XZ_MEMLIMIT_ERROR",
+	"XZ_FORMAT_ERROR",
+	"XZ_OPTIONS_ERROR",
+	"XZ_DATA_ERROR",
+	"XZ_BUF_ERROR"
+};
+
+/* Call xz_dec_run() and update the statistics. */
+static void run(void)
+{
+	size_t in_start = buffers.in_pos;
+	size_t out_start = buffers.out_pos;
+	uint64_t start = ktime_get_ns();
+
+	ret = xz_dec_run(state, &buffers);
+
+	decode_ns += ktime_get_ns() - start;
+	++calls;
+	in_bytes += buffers.in_pos - in_start;
+	out_bytes += buffers.out_pos - out_start;
+	crc = crc32(crc, buffer_out + out_start, buffers.out_pos - out_start);
+}
+
+/*
+ * Print the value of ret. At the end of the Stream, print also the CRC32
+ * and the statistics.
+ */
+static void print_ret(void)
+{
+	switch (ret) {
+	case XZ_STREAM_END:
+		printk(KERN_INFO DEVICE_NAME ": XZ_STREAM_END, "
+				"CRC32 = 0x%08X\n", ~crc);
+		printk(KERN_INFO DEVICE_NAME ": %llu bytes to %llu bytes "
+				"in %llu calls, %llu ns, %llu MB/s\n",
+				in_bytes, out_bytes, calls, decode_ns,
+				decode_ns == 0 ? 0 : div64_u64(
+					out_bytes * 1000, decode_ns));
+		break;
+
+	case XZ_OK:
+	case XZ_MEM_ERROR:
+	case XZ_MEMLIMIT_ERROR:
+	case XZ_FORMAT_ERROR:
+	case XZ_OPTIONS_ERROR:
+	case XZ_DATA_ERROR:
+	case XZ_BUF_ERROR:
+		printk(KERN_INFO DEVICE_NAME ": %s\n", ret_names[ret]);
+		break;
+
+	default:
+		printk(KERN_INFO DEVICE_NAME ": Bug detected!\n");
+		break;
+	}
+}
+
 static int xz_dec_test_open(struct inode *i, struct file *f)
 {
-	if (device_is_open)
+	if (!(f->f_mode & FMODE_WRITE))
+		return 0;
+
+	mutex_lock(&lock);
+
+	if (device_is_open) {
+		mutex_unlock(&lock);
 		return -EBUSY;
+	}
 
 	device_is_open = true;
 
@@ -75,21 +181,75 @@ static int xz_dec_test_open(struct inode *i, struct file *f)
 	buffers.in_size = 0;
 	buffers.out_pos = 0;
 
+	in_bytes = 0;
+	out_bytes = 0;
+	calls = 0;
+	decode_ns = 0;
+
+	mutex_unlock(&lock);
+
 	printk(KERN_INFO DEVICE_NAME ": opened\n");
 	return 0;
 }
 
 static int xz_dec_test_release(struct inode *i, struct file *f)
 {
-	device_is_open = false;
+	if (!(f->f_mode & FMODE_WRITE))
+		return 0;
+
+	mutex_lock(&lock);
+
+	/* In single-call mode the file is decoded now that all is there. */
+	if (dec_mode == XZ_SINGLE && ret == XZ_OK && buffers.in_size > 0) {
+		run();
+		print_ret();
+	}
 
 	if (ret == XZ_OK)
 		printk(KERN_INFO DEVICE_NAME ": input was truncated\n");
 
+	device_is_open = false;
+	mutex_unlock(&lock);
+
 	printk(KERN_INFO DEVICE_NAME ": closed\n");
 	return 0;
 }
 
+/* Give the statistics of the current or the latest file as text. */
+static ssize_t xz_dec_test_read(struct file *file, char __user *buf,
+				size_t size, loff_t *pos)
+{
+	char text[256];
+	int len;
+
+	mutex_lock(&lock);
+	len = scnprintf(text, sizeof(text),
+			"mode %s\nbuf_size %u\nresult %s\ncrc32 0x%08X\n"
+			"in_bytes %llu\nout_bytes %llu\ncalls %llu\n"
+			"decode_ns %llu\n",
+			mode, buf_size, ret_names[ret], ~crc,
+			in_bytes, out_bytes, calls, decode_ns);
+	mutex_unlock(&lock);
+
+	return simple_read_from_buffer(buf, size, pos, text, len);
+}
+
+/* Collect the whole input into buffer_in for single-call mode. */
+static ssize_t xz_dec_test_write_single(const char __user *buf, size_t size)
+{
+	if (size > buf_size - buffers.in_size) {
+		printk(KERN_INFO DEVICE_NAME ": the input doesn't fit "
+				"in buf_size bytes\n");
+		return -ENOSPC;
+	}
+
+	if (copy_from_user(buffer_in + buffers.in_size, buf, size))
+		return -EFAULT;
+
+	buffers.in_size += size;
+	return size;
+}
+
 /*
  * Decode the data given to us from the userspace. CRC32 of the uncompressed
  * data is calculated and is printed at the end of successful decoding. The
@@ -98,8 +258,7 @@ static int xz_dec_test_release(struct inode *i, struct file *f)
  * The .xz file must have exactly one Stream and no Stream Padding. The data
  * after the first Stream is considered to be garbage.
  */
-static ssize_t xz_dec_test_write(struct file *file, const char __user *buf,
-				 size_t size, loff_t *pos)
+static ssize_t xz_dec_test_decode(const char __user *buf, size_t size)
 {
 	size_t remaining;
 
@@ -112,6 +271,9 @@ static ssize_t xz_dec_test_write(struct file *file, const char __user *buf,
 		return -ENOSPC;
 	}
 
+	if (dec_mode == XZ_SINGLE)
+		return xz_dec_test_write_single(buf, size);
+
 	printk(KERN_INFO DEVICE_NAME ": decoding %zu bytes of input\n",
 			size);
 
@@ -120,7 +282,7 @@ static ssize_t xz_dec_test_write(struct file *file, const char __user *buf,
 			&& ret == XZ_OK) {
 		if (buffers.in_pos == buffers.in_size) {
 			buffers.in_pos = 0;
-			buffers.in_size = min(remaining, sizeof(buffer_in));
+			buffers.in_size = min_t(size_t, remaining, buf_size);
 			if (copy_from_user(buffer_in, buf, buffers.in_size))
 				return -EFAULT;
 
@@ -129,65 +291,76 @@ static ssize_t xz_dec_test_write(struct file *file, const char __user *buf,
 		}
 
 		buffers.out_pos = 0;
-		ret = xz_dec_run(state, &buffers);
-		crc = crc32(crc, buffer_out, buffers.out_pos);
+		run();
 	}
 
-	switch (ret) {
-	case XZ_OK:
-		printk(KERN_INFO DEVICE_NAME ": XZ_OK\n");
+	print_ret();
+
+	if (ret == XZ_OK)
 		return size;
 
-	case XZ_STREAM_END:
-		printk(KERN_INFO DEVICE_NAME ": XZ_STREAM_END, "
-				"CRC32 = 0x%08X\n", ~crc);
+	if (ret == XZ_STREAM_END)
 		return size - remaining - (buffers.in_size - buffers.in_pos);
 
-	case XZ_MEMLIMIT_ERROR:
-		printk(KERN_INFO DEVICE_NAME ": XZ_MEMLIMIT_ERROR\n");
-		break;
-
-	case XZ_FORMAT_ERROR:
-		printk(KERN_INFO DEVICE_NAME ": XZ_FORMAT_ERROR\n");
-		break;
-
-	case XZ_OPTIONS_ERROR:
-		printk(KERN_INFO DEVICE_NAME ": XZ_OPTIONS_ERROR\n");
-		break;
-
-	case XZ_DATA_ERROR:
-		printk(KERN_INFO DEVICE_NAME ": XZ_DATA_ERROR\n");
-		break;
+	return -EIO;
+}
 
-	case XZ_BUF_ERROR:
-		printk(KERN_INFO DEVICE_NAME ": XZ_BUF_ERROR\n");
-		break;
+static ssize_t xz_dec_test_write(struct file *file, const char __user *buf,
+				 size_t size, loff_t *pos)
+{
+	ssize_t written;
 
-	default:
-		printk(KERN_INFO DEVICE_NAME ": Bug detected!\n");
-		break;
-	}
+	mutex_lock(&lock);
+	written = xz_dec_test_decode(buf, size);
+	mutex_unlock(&lock);
 
-	return -EIO;
+	return written;
 }
 
-/* Allocate the XZ decoder state and register the character device. */
+/*
+ * Allocate the XZ decoder state and the buffers and register the
+ * character device.
+ */
 static int __init xz_dec_test_init(void)
 {
 	static const struct file_operations fileops = {
 		.owner = THIS_MODULE,
 		.open = &xz_dec_test_open,
 		.release = &xz_dec_test_release,
+		.read = &xz_dec_test_read,
 		.write = &xz_dec_test_write
 	};
 
-	state = xz_dec_init(XZ_PREALLOC, DICT_MAX);
+	if (strcmp(mode, "single") == 0)
+		dec_mode = XZ_SINGLE;
+	else if (strcmp(mode, "prealloc") == 0)
+		dec_mode = XZ_PREALLOC;
+	else if (strcmp(mode, "dynalloc") == 0)
+		dec_mode = XZ_DYNALLOC;
+	else
+		return -EINVAL;
+
+	if (buf_size == 0)
+		return -EINVAL;
+
+	buffer_in = vmalloc(buf_size);
+	buffer_out = vmalloc(buf_size);
+	if (buffer_in == NULL || buffer_out == NULL)
+		goto error_buffers;
+
+	buffers.in = buffer_in;
+	buffers.out = buffer_out;
+	buffers.out_size = buf_size;
+
+	state = xz_dec_init(dec_mode, DICT_MAX);
 	if (state == NULL)
-		return -ENOMEM;
+		goto error_buffers;
 
 	device_major = register_chrdev(0, DEVICE_NAME, &fileops);
 	if (device_major < 0) {
 		xz_dec_end(state);
+		vfree(buffer_out);
+		vfree(buffer_in);
 		return device_major;
 	}
 
@@ -196,12 +369,19 @@ static int __init xz_dec_test_init(void)
 			"'mknod " DEVICE_NAME " c %d 0' and write .xz files "
 			"to it.\n", device_major);
 	return 0;
+
+error_buffers:
+	vfree(buffer_out);
+	vfree(buffer_in);
+	return -ENOMEM;
 }
 
 static void __exit xz_dec_test_exit(void)
 {
 	unregister_chrdev(device_major, DEVICE_NAME);
 	xz_dec_end(state);
+	vfree(buffer_out);
+	vfree(buffer_in);
 	printk(KERN_INFO DEVICE_NAME ": module unloaded\n");
 }
 
@@ -42,9 +42,15 @@
 #		ifdef CONFIG_XZ_DEC_RISCV
 #			define XZ_DEC_RISCV
 #		endif
+#		ifdef CONFIG_XZ_DEC_DELTA
+#			define XZ_DEC_DELTA
+#		endif
 #		ifdef CONFIG_XZ_DEC_MICROLZMA
 #			define XZ_DEC_MICROLZMA
 #		endif
+#		ifdef CONFIG_XZ_DEC_IOV
+#			define XZ_DEC_IOV
+#		endif
 #		define memeq(a, b, size) (memcmp(a, b, size) == 0)
 #		define memzero(buf, size) memset(buf, 0, size)
 #	endif
@@ -97,6 +103,24 @@
 #	define DEC_IS_MULTI(mode) (false)
 #endif
 
+/*
+ * Static trace points: XZ_TRACE(name, args...) fires the tracepoint
+ * trace_xz_<name>() from <trace/events/xz.h> in the kernel and the USDT
+ * probe xz:<name> in userspace if XZ_USE_SDT is defined. <sys/sdt.h> from
+ * SystemTap is needed for the latter. Both are only a nop instruction when
+ * nothing is attached. Otherwise XZ_TRACE expands to nothing, so the
+ * arguments must not have side effects.
+ */
+#if defined(__KERNEL__) && !defined(XZ_PREBOOT)
+#	include <trace/events/xz.h>
+#	define XZ_TRACE(name, ...) trace_xz_##name(__VA_ARGS__)
+#elif !defined(__KERNEL__) && defined(XZ_USE_SDT)
+#	include <sys/sdt.h>
+#	define XZ_TRACE(name, ...) STAP_PROBEV(xz, name, __VA_ARGS__)
+#else
+#	define XZ_TRACE(name, ...) ((void)0)
+#endif
+
 /*
  * If any of the BCJ filter decoders are wanted, define XZ_DEC_BCJ.
  * XZ_DEC_BCJ is used to enable generic support for BCJ decoders.
@@ -120,6 +144,11 @@ struct xz_sha256 {
 
 	/* Size of the input data */
 	uint64_t size;
+
+#ifdef XZ_SIMD_SHA
+	/* True if the x86 SHA extensions can be used */
+	bool sha_ext;
+#endif
 };
 
 /* Reset the SHA-256 state to prepare for a new calculation. */
@@ -158,6 +187,75 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 /* Free the memory allocated for the LZMA2 decoder. */
 XZ_EXTERN void xz_dec_lzma2_end(struct xz_dec_lzma2 *s);
 
+/*
+ * Return the number of bytes that xz_dec_lzma2_create() allocates plus
+ * the dictionary of dict_size bytes in multi-call mode.
+ */
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage(enum xz_mode mode,
+					  uint32_t dict_size);
+
+/* Return the number of bytes currently allocated for the LZMA2 decoder. */
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage_of(const struct xz_dec_lzma2 *s);
+
+/*
+ * Return the biggest value that xz_dec_lzma2_memusage_of() has had since
+ * xz_dec_lzma2_create() or xz_dec_lzma2_reset_peak().
+ */
+XZ_EXTERN uint64_t xz_dec_lzma2_memusage_peak(const struct xz_dec_lzma2 *s);
+
+/* Start tracking the peak again from the current memory usage. */
+XZ_EXTERN void xz_dec_lzma2_reset_peak(struct xz_dec_lzma2 *s);
+
+#ifdef XZ_DEC_SAVE
+/*
+ * Return the number of bytes that xz_dec_lzma2_save() writes. This must be
+ * used only between xz_dec_lzma2_reset() and the end of the LZMA2 data.
+ */
+XZ_EXTERN size_t xz_dec_lzma2_save_size(const struct xz_dec_lzma2 *s);
+
+/* Copy the decoder state including the dictionary contents to buf. */
+XZ_EXTERN void xz_dec_lzma2_save(const struct xz_dec_lzma2 *s, uint8_t *buf);
+
+/*
+ * Restore the state saved with xz_dec_lzma2_save(). The dictionary buffer
+ * is allocated in XZ_DYNALLOC mode if needed. If this fails, the LZMA2
+ * decoder must be reset before it is used again.
+ */
+XZ_EXTERN enum xz_ret xz_dec_lzma2_restore(struct xz_dec_lzma2 *s,
+					   const uint8_t *buf, size_t size);
+#endif
+
+#ifdef XZ_DEC_FLUSH
+/* Set if xz_dec_lzma2_run() should return after each LZMA2 chunk. */
+XZ_EXTERN void xz_dec_lzma2_set_flush(struct xz_dec_lzma2 *s, bool flush);
+
+/* Return the number of decoded bytes that haven't been written to b->out. */
+XZ_EXTERN size_t xz_dec_lzma2_held(const struct xz_dec_lzma2 *s);
+#endif
+
+#ifdef XZ_DEC_STATS
+/* Get a pointer to the statistics counters of the LZMA2 decoder. */
+XZ_EXTERN struct xz_dec_stats *xz_dec_lzma2_stats(struct xz_dec_lzma2 *s);
+#endif
+
+#ifdef XZ_DEC_SKIP
+/*
+ * Update the integrity check of the current Block in the .xz decoder.
+ * This is used only by the LZMA2 decoder when skipping output.
+ */
+XZ_EXTERN void xz_dec_skip_update(struct xz_dec *s, const uint8_t *buf,
+				  size_t size);
+
+/*
+ * Like xz_dec_lzma2_run() but b->out must be NULL and the uncompressed
+ * data is only given to xz_dec_skip_update(). This must not be used in
+ * single-call mode.
+ */
+XZ_EXTERN enum xz_ret xz_dec_lzma2_run_skip(struct xz_dec_lzma2 *s,
+					    struct xz_buf *b,
+					    struct xz_dec *dec);
+#endif
+
 #ifdef XZ_DEC_BCJ
 /*
  * Allocate memory for BCJ decoders. xz_dec_bcj_reset() must be used before
@@ -165,6 +263,27 @@ XZ_EXTERN void xz_dec_lzma2_end(struct xz_dec_lzma2 *s);
  */
 XZ_EXTERN struct xz_dec_bcj *xz_dec_bcj_create(bool single_call);
 
+/* Return the number of bytes that xz_dec_bcj_create() allocates. */
+XZ_EXTERN size_t xz_dec_bcj_memusage(void);
+
+/* Return true if the BCJ filter with the given Filter ID is supported. */
+XZ_EXTERN bool xz_dec_bcj_supported(uint8_t id);
+
+#ifdef XZ_DEC_SAVE
+/*
+ * Copy the BCJ filter state to buf or restore it from there. The size is
+ * xz_dec_bcj_memusage() bytes.
+ */
+XZ_EXTERN void xz_dec_bcj_save(const struct xz_dec_bcj *s, uint8_t *buf);
+XZ_EXTERN enum xz_ret xz_dec_bcj_restore(struct xz_dec_bcj *s,
+					 const uint8_t *buf);
+#endif
+
+#ifdef XZ_DEC_FLUSH
+/* Return the number of bytes waiting in the BCJ filter's temp buffer. */
+XZ_EXTERN size_t xz_dec_bcj_held(const struct xz_dec_bcj *s);
+#endif
+
 /*
  * Decode the Filter ID of a BCJ filter. This implementation doesn't
  * support custom start offsets, so no decoding of Filter Properties
@@ -173,17 +292,139 @@ XZ_EXTERN struct xz_dec_bcj *xz_dec_bcj_create(bool single_call);
  */
 XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id);
 
+struct xz_dec_delta;
+
 /*
- * Decode raw BCJ + LZMA2 stream. This must be used only if there actually is
- * a BCJ filter in the chain. If the chain has only LZMA2, xz_dec_lzma2_run()
- * must be called directly.
+ * Decode raw BCJ + [Delta +] LZMA2 stream. This must be used only if there
+ * actually is a BCJ filter in the chain. If the chain has only LZMA2,
+ * xz_dec_lzma2_run() must be called directly. delta must be NULL if there
+ * is no Delta filter in the chain.
  */
 XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 				     struct xz_dec_lzma2 *lzma2,
+				     struct xz_dec_delta *delta,
 				     struct xz_buf *b);
 
+/*
+ * Apply the BCJ filter on the data that xz_dec_lzma2_run_bcj() has written
+ * to b->out since the previous call. This is used only by the LZMA2 decoder.
+ */
+XZ_EXTERN void xz_dec_bcj_filter_out(struct xz_dec_bcj *s,
+				     const struct xz_buf *b);
+
+/*
+ * Like xz_dec_lzma2_run() but call xz_dec_bcj_filter_out() every time new
+ * data has been written to b->out. This must not be used in single-call mode.
+ */
+XZ_EXTERN enum xz_ret xz_dec_lzma2_run_bcj(struct xz_dec_lzma2 *s,
+					   struct xz_buf *b,
+					   struct xz_dec_bcj *bcj);
+
 /* Free the memory allocated for the BCJ filters. */
 #define xz_dec_bcj_end(s) kfree(s)
 #endif
 
+#ifdef XZ_DEC_DELTA
+/*
+ * Allocate memory for the Delta decoder. xz_dec_delta_reset() must be used
+ * before calling xz_dec_delta_run().
+ */
+XZ_EXTERN struct xz_dec_delta *xz_dec_delta_create(bool single_call);
+
+/* Return the number of bytes that xz_dec_delta_create() allocates. */
+XZ_EXTERN size_t xz_dec_delta_memusage(void);
+
+#ifdef XZ_DEC_SAVE
+/*
+ * Copy the Delta filter state to buf or restore it from there. The size is
+ * xz_dec_delta_memusage() bytes.
+ */
+XZ_EXTERN void xz_dec_delta_save(const struct xz_dec_delta *s, uint8_t *buf);
+XZ_EXTERN enum xz_ret xz_dec_delta_restore(struct xz_dec_delta *s,
+					   const uint8_t *buf);
+#endif
+
+/*
+ * Reset the Delta decoder. props is the one-byte Filter Properties field,
+ * which contains the delta distance minus one. All values are valid.
+ */
+XZ_EXTERN void xz_dec_delta_reset(struct xz_dec_delta *s, uint8_t props);
+
+/*
+ * Decode raw Delta + LZMA2 stream. This must be used only if there actually
+ * is a Delta filter in the chain.
+ */
+XZ_EXTERN enum xz_ret xz_dec_delta_run(struct xz_dec_delta *s,
+				       struct xz_dec_lzma2 *lzma2,
+				       struct xz_buf *b);
+
+/* Free the memory allocated for the Delta filter. */
+#define xz_dec_delta_end(s) kfree(s)
+#endif
+
+#ifdef XZ_DEC_IOV
+/*
+ * Set up b to decode from the current input segment of v into the current
+ * output segment of v. Used-up segments are skipped unless they are last.
+ */
+static inline void xz_iov_load(struct xz_buf_iov *v, struct xz_buf *b)
+{
+	while (v->in_index + 1 < v->in_count
+			&& v->in_pos == v->in[v->in_index].size) {
+		++v->in_index;
+		v->in_pos = 0;
+	}
+
+	while (v->out_index + 1 < v->out_count
+			&& v->out_pos == v->out[v->out_index].size) {
+		++v->out_index;
+		v->out_pos = 0;
+	}
+
+	if (v->in_count == 0) {
+		b->in = NULL;
+		b->in_pos = 0;
+		b->in_size = 0;
+	} else {
+		b->in = v->in[v->in_index].buf;
+		b->in_pos = v->in_pos;
+		b->in_size = v->in[v->in_index].size;
+	}
+
+	if (v->out_count == 0) {
+		b->out = NULL;
+		b->out_pos = 0;
+		b->out_size = 0;
+	} else {
+		b->out = v->out[v->out_index].buf;
+		b->out_pos = v->out_pos;
+		b->out_size = v->out[v->out_index].size;
+	}
+}
+
+/*
+ * Store the positions from b back to v. Return true if the current input
+ * or output segment was used up and there is another segment after it.
+ */
+static inline bool xz_iov_store(struct xz_buf_iov *v, const struct xz_buf *b)
+{
+	bool more = false;
+
+	if (v->in_count != 0) {
+		v->in_pos = b->in_pos;
+		if (b->in_pos == b->in_size && v->in_index + 1 < v->in_count)
+			more = true;
+	}
+
+	if (v->out_count != 0) {
+		v->out_pos = b->out_pos;
+		if (b->out_pos == b->out_size
+				&& v->out_index + 1 < v->out_count)
+			more = true;
+	}
+
+	return more;
+}
+#endif
+
 #endif
@@ -100,6 +100,78 @@ transform(uint32_t state[8], const uint8_t data[64])
 	state[7] += h(0);
 }
 
+#ifdef XZ_SIMD_SHA
+/*
+ * SHA-256 using the x86 SHA extensions. The message schedule is calculated
+ * four words at a time with SHA256MSG1 and SHA256MSG2, and SHA256RNDS2
+ * does two rounds at a time using the state in the ABEF and CDGH order.
+ */
+static XZ_SIMD_SHA_FUNC void transform_sha(uint32_t state[8],
+					   const uint8_t data[64])
+{
+	const __m128i bswap = _mm_set_epi64x(0x0C0D0E0F08090A0BLL,
+					     0x0405060700010203LL);
+	__m128i abef;
+	__m128i cdgh;
+	__m128i abef_orig;
+	__m128i cdgh_orig;
+	__m128i tmp;
+	__m128i msg[4];
+	unsigned int i;
+
+	/* Convert the state from ABCD EFGH to ABEF CDGH. */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xB1);
+	cdgh = _mm_shuffle_epi32(
+			_mm_loadu_si128((const __m128i *)(state + 4)), 0x1B);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	abef_orig = abef;
+	cdgh_orig = cdgh;
+
+	for (i = 0; i < 16; ++i) {
+		if (i < 4) {
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *)(data + 16 * i)),
+					bswap);
+		} else {
+			tmp = _mm_add_epi32(
+				_mm_sha256msg1_epu32(msg[i & 3],
+						     msg[(i + 1) & 3]),
+				_mm_alignr_epi8(msg[(i + 3) & 3],
+						msg[(i + 2) & 3], 4));
+			msg[i & 3] = _mm_sha256msg2_epu32(tmp,
+							  msg[(i + 3) & 3]);
+		}
+
+		tmp = _mm_add_epi32(msg[i & 3], _mm_loadu_si128(
+				(const __m128i *)(SHA256_K + 4 * i)));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, tmp);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh,
+					     _mm_shuffle_epi32(tmp, 0x0E));
+	}
+
+	abef = _mm_add_epi32(abef, abef_orig);
+	cdgh = _mm_add_epi32(cdgh, cdgh_orig);
+
+	/* Convert the state back to ABCD EFGH. */
+	tmp = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+static void sha256_transform(struct xz_sha256 *s)
+{
+	if (s->sha_ext)
+		transform_sha(s->state, s->data);
+	else
+		transform(s->state, s->data);
+}
+#else
+#	define sha256_transform(s) transform((s)->state, (s)->data)
+#endif
+
 XZ_EXTERN void xz_sha256_reset(struct xz_sha256 *s)
 {
 	static const uint32_t initial_state[8] = {
@@ -109,6 +181,10 @@ XZ_EXTERN void xz_sha256_reset(struct xz_sha256 *s)
 
 	memcpy(s->state, initial_state, sizeof(initial_state));
 	s->size = 0;
+
+#ifdef XZ_SIMD_SHA
+	s->sha_ext = xz_cpu_has(XZ_CPU_SHA);
+#endif
 }
 
 XZ_EXTERN void xz_sha256_update(const uint8_t *buf, size_t size,
@@ -139,7 +215,7 @@ XZ_EXTERN void xz_sha256_update(const uint8_t *buf, size_t size,
 		s->size += copy_size;
 
 		if ((s->size & 0x3F) == 0)
-			transform(s->state, s->data);
+			sha256_transform(s);
 	}
 }
 
@@ -154,7 +230,7 @@ XZ_EXTERN bool xz_sha256_validate(const uint8_t *buf, struct xz_sha256 *s)
 
 	while (i != 64 - 8) {
 		if (i == 64) {
-			transform(s->state, s->data);
+			sha256_transform(s);
 			i = 0;
 		}
 
@@ -171,7 +247,7 @@ XZ_EXTERN bool xz_sha256_validate(const uint8_t *buf, struct xz_sha256 *s)
 	for (i = 0; i < 8; ++i)
 		s->data[64 - 8 + i] = (uint8_t)(s->size >> ((7 - i) * 8));
 
-	transform(s->state, s->data);
+	sha256_transform(s);
 
 	/* Compare if the hash value matches the first 32 bytes in buf. */
 	for (i = 0; i < 8; ++i)
@@ -31,6 +31,25 @@ static void error(/*const*/ char *msg)
 #undef XZ_USE_CRC64
 #undef XZ_USE_SHA256
 
+/* The Delta filter isn't supported by decompress_unxz.c. */
+#undef XZ_DEC_DELTA
+
+/*
+ * The boot code doesn't skip output, probe the headers, need the
+ * Block and Stream boundaries, use scattered buffers, save the
+ * decoder state, need low-latency output, or collect statistics.
+ */
+#undef XZ_DEC_SKIP
+#undef XZ_DEC_PROBE
+#undef XZ_DEC_EVENTS
+#undef XZ_DEC_IOV
+#undef XZ_DEC_SAVE
+#undef XZ_DEC_FLUSH
+#undef XZ_DEC_STATS
+
+/* The boot code doesn't use the runtime CPU feature detection. */
+#undef XZ_USE_DISPATCH
+
 #include "../linux/lib/decompress_unxz.c"
 
 static uint8_t in[1024 * 1024];
@@ -0,0 +1,72 @@
+#!/bin/sh
+# SPDX-License-Identifier: 0BSD
+
+#############################################################################
+#
+# Create a set of synthetic .xz files with xzgen, each of which stresses
+# one part of the decoder, and benchmark them with xzbench:
+#
+#     make xzgen xzbench
+#     sh create_bench_corpus.sh corpus
+#     ./xzbench corpus/*.xz > results.json
+#
+# The per-call latencies with packet-sized input and page-sized output
+# can be measured from the same files:
+#
+#     ./xzbench -i 1500 -o 4096 corpus/*.xz > latency.json
+#
+# The files are always the same, so results from different builds and
+# machines can be compared.
+#
+#############################################################################
+
+set -e
+
+DIR=${1:-corpus}
+GEN=${XZGEN:-./xzgen}
+
+mkdir -p "$DIR"
+
+gen()
+{
+	NAME=$1
+	shift
+	"$GEN" -s 4194304 "$@" > "$DIR/$NAME.xz"
+}
+
+# lzma_literal()
+gen literal -l 100
+gen literal-text -l 100 -a 64
+
+# lzma_match() with near and far distances
+gen match-near -l 0 -r 0 -d 256
+gen match-far -l 0 -r 0
+gen match-short -l 0 -r 0 -m 4
+
+# lzma_rep_match()
+gen rep -l 0 -r 100
+
+# A mix that resembles ordinary compressed data
+gen mixed -l 30 -r 30 -a 96
+
+# dict_uncompressed()
+gen uncompressed -u 100
+
+# Small chunks and frequent resets, and many Blocks
+gen chunks -c 4096 -t 4 -D 16
+gen blocks -s 65536 -b 64
+
+# The check types
+gen check-none -C none
+gen check-crc64 -C crc64
+gen check-sha256 -C sha256
+
+# The Delta filter with a small, a power-of-two, and the largest distance
+gen delta-1 -l 80 -e 1
+gen delta-4 -l 80 -e 4
+gen delta-256 -l 80 -e 256
+
+# The BCJ filters
+for FILTER in x86 powerpc ia64 arm armthumb sparc arm64 riscv; do
+	gen "bcj-$FILTER" -l 80 -f "$FILTER"
+done
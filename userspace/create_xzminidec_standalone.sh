@@ -37,7 +37,7 @@ cat << EOF
  *
  * Build instructions:
  *
- *     cc -O2 -o xzminidec xzminidec_standalone.c
+ *     cc -O2 -pthread -o xzminidec xzminidec_standalone.c
  *
  * Compressed .xz file is read from standard input and decompressed data
  * is written to standard output. Examples:
@@ -46,6 +46,11 @@ cat << EOF
  *     ./xzminidec < foo.tar.xz | tar xf -
  */
 
+/* xzminidec.c uses vmsplice() on Linux. This must be before all #includes. */
+#ifdef __linux__
+#	define _GNU_SOURCE
+#endif
+
 /* Enable support for concatenated .xz files. */
 #define XZ_DEC_CONCATENATED
 
@@ -63,6 +68,9 @@ cat << EOF
 #define XZ_DEC_POWERPC
 #define XZ_DEC_IA64
 #define XZ_DEC_SPARC
+
+/* The -f option needs the Block events. */
+#define XZ_DEC_EVENTS
 EOF
 
 # Combine the files. The order of xz.h, xz_config.h, and xz_private.h matters
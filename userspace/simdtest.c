@@ -0,0 +1,403 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Differential test for the SIMD code paths
+ *
+ * Random data is decoded through every BCJ filter, the Delta filter, and
+ * BCJ + Delta chains in multi-call mode with random input and output
+ * buffer boundaries. The result is compared with the portable C code from
+ * simdtest_ref.c run in single-call mode. CRC32, CRC64, and SHA-256 of
+ * random data in random pieces are compared the same way.
+ *
+ * Run this also with XZ_CPU_FEATURES= in the environment to test
+ * the code that is used when no optional CPU features are available.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../linux/lib/xz/xz_private.h"
+
+struct xz_dec_bcj *ref_xz_dec_bcj_create(bool single_call);
+enum xz_ret ref_xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id);
+enum xz_ret ref_xz_dec_bcj_run(struct xz_dec_bcj *s,
+			       struct xz_dec_lzma2 *lzma2,
+			       struct xz_dec_delta *delta, struct xz_buf *b);
+struct xz_dec_delta *ref_xz_dec_delta_create(bool single_call);
+void ref_xz_dec_delta_reset(struct xz_dec_delta *s, uint8_t props);
+enum xz_ret ref_xz_dec_delta_run(struct xz_dec_delta *s,
+				 struct xz_dec_lzma2 *lzma2,
+				 struct xz_buf *b);
+void ref_xz_crc32_init(void);
+uint32_t ref_xz_crc32(const uint8_t *buf, size_t size, uint32_t crc);
+void ref_xz_crc64_init(void);
+uint64_t ref_xz_crc64(const uint8_t *buf, size_t size, uint64_t crc);
+void ref_xz_sha256_reset(struct xz_sha256 *s);
+void ref_xz_sha256_update(const uint8_t *buf, size_t size,
+			  struct xz_sha256 *s);
+bool ref_xz_sha256_validate(const uint8_t *buf, struct xz_sha256 *s);
+
+/* Filter IDs of the BCJ filters */
+static const uint8_t bcj_ids[] = { 4, 5, 6, 7, 8, 9, 10, 11 };
+
+/*
+ * Bytes that start or are a part of the instructions that the BCJ
+ * filters convert, or that the SIMD code compares against.
+ */
+static const uint8_t opcodes[] = {
+	0x00, 0xFF, 0xE8, 0xE9, 0x0F, 0x80, 0x48, 0x4B, 0x40, 0x7F,
+	0x94, 0x97, 0x90, 0xB0, 0xEB, 0xF0, 0xF8, 0x17, 0x6F, 0xEF,
+	0x10, 0x05, 0x1D
+};
+
+/* Maximum sizes of the random input and output pieces */
+static const size_t step_max[] = { 1, 16, 4096, 65536 };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Biggest test case */
+#define DATA_MAX (1 << 18)
+
+static uint64_t rng;
+
+static uint32_t rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return (uint32_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 32);
+}
+
+static size_t rnd_size(size_t max)
+{
+	return rnd() % (max + 1);
+}
+
+/*
+ * Fill buf with random bytes. About half of them are from opcodes[] so
+ * that the filters find something to convert.
+ */
+static void fill(uint8_t *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		if (rnd() & 1)
+			buf[i] = (uint8_t)rnd();
+		else
+			buf[i] = opcodes[rnd() % sizeof(opcodes)];
+	}
+}
+
+/*
+ * Store data as uncompressed LZMA2 chunks to buf. Return the size of
+ * the LZMA2 data.
+ */
+static size_t lzma2_encode(uint8_t *buf, const uint8_t *data, size_t size)
+{
+	size_t pos = 0;
+	size_t chunk;
+	bool first = true;
+
+	while (size > 0) {
+		chunk = size < 65536 ? size : 65536;
+		buf[pos++] = first ? 0x01 : 0x02;
+		buf[pos++] = (uint8_t)((chunk - 1) >> 8);
+		buf[pos++] = (uint8_t)(chunk - 1);
+		memcpy(buf + pos, data, chunk);
+		pos += chunk;
+		data += chunk;
+		size -= chunk;
+		first = false;
+	}
+
+	buf[pos++] = 0x00;
+	return pos;
+}
+
+/*
+ * Decode the filter chain in multi-call mode. The input and output
+ * buffers are made available in random pieces of at most step bytes.
+ */
+static enum xz_ret decode_multi(struct xz_dec_bcj *bcj,
+				struct xz_dec_lzma2 *lzma2,
+				struct xz_dec_delta *delta,
+				const uint8_t *in, size_t in_size,
+				uint8_t *out, size_t out_size, size_t step)
+{
+	struct xz_buf b;
+	enum xz_ret ret;
+
+	b.in = in;
+	b.in_pos = 0;
+	b.in_size = 0;
+	b.out = out;
+	b.out_pos = 0;
+	b.out_size = 0;
+
+	do {
+		b.in_size += 1 + rnd_size(step - 1);
+		if (b.in_size > in_size)
+			b.in_size = in_size;
+
+		b.out_size += 1 + rnd_size(step - 1);
+		if (b.out_size > out_size)
+			b.out_size = out_size;
+
+		if (bcj != NULL)
+			ret = xz_dec_bcj_run(bcj, lzma2, delta, &b);
+		else
+			ret = xz_dec_delta_run(delta, lzma2, &b);
+
+		if (ret == XZ_OK && b.in_pos == in_size
+				&& b.out_pos == out_size)
+			return XZ_DATA_ERROR;
+	} while (ret == XZ_OK);
+
+	return ret == XZ_STREAM_END && b.out_pos == out_size
+			? XZ_OK : XZ_DATA_ERROR;
+}
+
+/* Decode the filter chain with the reference code in single-call mode. */
+static enum xz_ret decode_ref(struct xz_dec_bcj *bcj,
+			      struct xz_dec_lzma2 *lzma2,
+			      struct xz_dec_delta *delta,
+			      const uint8_t *in, size_t in_size,
+			      uint8_t *out, size_t out_size)
+{
+	struct xz_buf b;
+	enum xz_ret ret;
+
+	b.in = in;
+	b.in_pos = 0;
+	b.in_size = in_size;
+	b.out = out;
+	b.out_pos = 0;
+	b.out_size = out_size;
+
+	if (bcj != NULL)
+		ret = ref_xz_dec_bcj_run(bcj, lzma2, delta, &b);
+	else
+		ret = ref_xz_dec_delta_run(delta, lzma2, &b);
+
+	return ret == XZ_STREAM_END && b.out_pos == out_size
+			? XZ_OK : XZ_DATA_ERROR;
+}
+
+/* Pick a Delta distance. Small ones and powers of two are common. */
+static uint8_t delta_props(void)
+{
+	switch (rnd() % 3) {
+	case 0:
+		return (uint8_t)rnd_size(15);
+
+	case 1:
+		return (uint8_t)((1U << rnd_size(8)) - 1);
+
+	default:
+		return (uint8_t)rnd();
+	}
+}
+
+/*
+ * Test one filter chain. bcj_id is 0 if there is no BCJ filter and
+ * delta is false if there is no Delta filter. Return true on success.
+ */
+static bool test_filters(uint8_t bcj_id, bool delta)
+{
+	static uint8_t data[DATA_MAX];
+	static uint8_t in[DATA_MAX + DATA_MAX / 65536 * 3 + 16];
+	static uint8_t out[DATA_MAX + 64];
+	static uint8_t ref[DATA_MAX];
+
+	struct xz_dec_lzma2 *lzma2 = NULL;
+	struct xz_dec_lzma2 *ref_lzma2 = NULL;
+	struct xz_dec_bcj *bcj = NULL;
+	struct xz_dec_bcj *ref_bcj = NULL;
+	struct xz_dec_delta *dlt = NULL;
+	struct xz_dec_delta *ref_dlt = NULL;
+	size_t step = step_max[rnd() % ARRAY_SIZE(step_max)];
+	size_t size = rnd_size(step < DATA_MAX / 256
+			       ? step * 256 : DATA_MAX);
+	size_t offset = rnd_size(31);
+	size_t in_size;
+	uint8_t props = delta_props();
+	bool success = false;
+
+	fill(data, size);
+	in_size = lzma2_encode(in, data, size);
+
+	lzma2 = xz_dec_lzma2_create(XZ_PREALLOC, 1 << 12);
+	ref_lzma2 = xz_dec_lzma2_create(XZ_SINGLE, 0);
+	if (lzma2 == NULL || ref_lzma2 == NULL)
+		goto out;
+
+	if (bcj_id != 0) {
+		bcj = xz_dec_bcj_create(false);
+		ref_bcj = ref_xz_dec_bcj_create(true);
+		if (bcj == NULL || ref_bcj == NULL
+				|| xz_dec_bcj_reset(bcj, bcj_id) != XZ_OK
+				|| ref_xz_dec_bcj_reset(ref_bcj, bcj_id)
+					!= XZ_OK)
+			goto out;
+	}
+
+	if (delta) {
+		dlt = xz_dec_delta_create(false);
+		ref_dlt = ref_xz_dec_delta_create(true);
+		if (dlt == NULL || ref_dlt == NULL)
+			goto out;
+
+		xz_dec_delta_reset(dlt, props);
+		ref_xz_dec_delta_reset(ref_dlt, props);
+	}
+
+	if (xz_dec_lzma2_reset(lzma2, 0) != XZ_OK
+			|| xz_dec_lzma2_reset(ref_lzma2, 0) != XZ_OK)
+		goto out;
+
+	if (decode_ref(ref_bcj, ref_lzma2, ref_dlt, in, in_size,
+		       ref, size) != XZ_OK) {
+		fputs("Reference decoder failed\n", stderr);
+		goto out;
+	}
+
+	if (decode_multi(bcj, lzma2, dlt, in, in_size,
+			 out + offset, size, step) != XZ_OK) {
+		fputs("Decoder failed\n", stderr);
+		goto out;
+	}
+
+	success = memcmp(out + offset, ref, size) == 0;
+
+out:
+	if (!success)
+		fprintf(stderr, "BCJ %u, Delta %d (distance %u), "
+				"%zu bytes, step %zu, offset %zu: FAIL\n",
+				bcj_id, delta, props + 1U, size, step,
+				offset);
+
+	xz_dec_lzma2_end(lzma2);
+	xz_dec_lzma2_end(ref_lzma2);
+	free(bcj);
+	free(ref_bcj);
+	free(dlt);
+	free(ref_dlt);
+	return success;
+}
+
+/*
+ * Compare CRC32, CRC64, and SHA-256 of random data that is given in random
+ * pieces at a random alignment. Return true on success.
+ */
+static bool test_checks(void)
+{
+	static uint8_t buf[DATA_MAX + 64];
+
+	struct xz_sha256 sha;
+	struct xz_sha256 ref_sha;
+	uint8_t hash[32];
+	size_t step = step_max[rnd() % ARRAY_SIZE(step_max)];
+	size_t size = rnd_size(step < DATA_MAX / 64 ? step * 64 : DATA_MAX);
+	size_t offset = rnd_size(63);
+	size_t pos = 0;
+	size_t piece;
+	uint32_t crc32 = 0;
+	uint64_t crc64 = 0;
+	size_t i;
+	bool success = true;
+
+	fill(buf + offset, size);
+
+	xz_sha256_reset(&sha);
+	while (pos < size) {
+		piece = 1 + rnd_size(step - 1);
+		if (piece > size - pos)
+			piece = size - pos;
+
+		crc32 = xz_crc32(buf + offset + pos, piece, crc32);
+		crc64 = xz_crc64(buf + offset + pos, piece, crc64);
+		xz_sha256_update(buf + offset + pos, piece, &sha);
+		pos += piece;
+	}
+
+	if (crc32 != ref_xz_crc32(buf + offset, size, 0)) {
+		fputs("CRC32 differs\n", stderr);
+		success = false;
+	}
+
+	if (crc64 != ref_xz_crc64(buf + offset, size, 0)) {
+		fputs("CRC64 differs\n", stderr);
+		success = false;
+	}
+
+	/*
+	 * xz_sha256_validate() leaves the hash in state[], so the reference
+	 * result is taken from there and given to the tested code.
+	 */
+	memset(hash, 0, sizeof(hash));
+	ref_xz_sha256_reset(&ref_sha);
+	ref_xz_sha256_update(buf + offset, size, &ref_sha);
+	ref_xz_sha256_validate(hash, &ref_sha);
+	for (i = 0; i < 8; ++i)
+		put_unaligned_be32(ref_sha.state[i], hash + 4 * i);
+
+	if (!xz_sha256_validate(hash, &sha)) {
+		fputs("SHA-256 differs\n", stderr);
+		success = false;
+	}
+
+	if (!success)
+		fprintf(stderr, "%zu bytes, step %zu, offset %zu: FAIL\n",
+				size, step, offset);
+
+	return success;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long iterations = 200;
+	unsigned long seed = 1;
+	unsigned long i;
+	size_t j;
+	unsigned failed = 0;
+
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 0);
+
+	if (argc > 2)
+		seed = strtoul(argv[2], NULL, 0);
+
+	if (argc > 3 || seed == 0) {
+		fputs("Usage: simdtest [ITERATIONS [SEED]]\n"
+				"SEED must not be zero.\n", stderr);
+		return 2;
+	}
+
+	rng = seed;
+
+	xz_crc32_init();
+	xz_crc64_init();
+	ref_xz_crc32_init();
+	ref_xz_crc64_init();
+
+#ifdef XZ_USE_DISPATCH
+	printf("CPU features: 0x%X\n", (unsigned)xz_cpu_features());
+#endif
+
+	for (i = 0; i < iterations; ++i) {
+		for (j = 0; j < ARRAY_SIZE(bcj_ids); ++j) {
+			failed += !test_filters(bcj_ids[j], false);
+			failed += !test_filters(bcj_ids[j], rnd() % 4 == 0);
+		}
+
+		failed += !test_filters(0, true);
+		failed += !test_checks();
+	}
+
+	printf("%lu iterations with seed %lu: %u failures\n",
+			iterations, seed, failed);
+
+	return failed != 0;
+}
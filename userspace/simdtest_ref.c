@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Portable C reference for simdtest.c
+ *
+ * The filters and the integrity checks are built here a second time
+ * without SIMD code and without the runtime processor feature detection.
+ * The functions get the prefix ref_ so that they can be linked into the
+ * same program with the normal build of the same files.
+ */
+
+#define XZ_NO_SIMD
+#undef XZ_USE_DISPATCH
+
+#define xz_dec_bcj_create ref_xz_dec_bcj_create
+#define xz_dec_bcj_filter_out ref_xz_dec_bcj_filter_out
+#define xz_dec_bcj_held ref_xz_dec_bcj_held
+#define xz_dec_bcj_memusage ref_xz_dec_bcj_memusage
+#define xz_dec_bcj_reset ref_xz_dec_bcj_reset
+#define xz_dec_bcj_restore ref_xz_dec_bcj_restore
+#define xz_dec_bcj_run ref_xz_dec_bcj_run
+#define xz_dec_bcj_save ref_xz_dec_bcj_save
+#define xz_dec_bcj_supported ref_xz_dec_bcj_supported
+
+#define xz_dec_delta_create ref_xz_dec_delta_create
+#define xz_dec_delta_memusage ref_xz_dec_delta_memusage
+#define xz_dec_delta_reset ref_xz_dec_delta_reset
+#define xz_dec_delta_restore ref_xz_dec_delta_restore
+#define xz_dec_delta_run ref_xz_dec_delta_run
+#define xz_dec_delta_save ref_xz_dec_delta_save
+
+#define xz_crc32_init ref_xz_crc32_init
+#define xz_crc32 ref_xz_crc32
+#define xz_crc64_init ref_xz_crc64_init
+#define xz_crc64 ref_xz_crc64
+
+#define xz_sha256_reset ref_xz_sha256_reset
+#define xz_sha256_update ref_xz_sha256_update
+#define xz_sha256_validate ref_xz_sha256_validate
+
+#include "../linux/lib/xz/xz_dec_bcj.c"
+#include "../linux/lib/xz/xz_dec_delta.c"
+#include "../linux/lib/xz/xz_crc32.c"
+#include "../linux/lib/xz/xz_crc64.c"
+#include "../linux/lib/xz/xz_sha256.c"
@@ -12,9 +12,42 @@
 /* Uncomment to enable building of xz_dec_catrun(). */
 /* #define XZ_DEC_CONCATENATED */
 
+/* Uncomment to enable building of xz_dec_skip(). */
+/* #define XZ_DEC_SKIP */
+
+/* Uncomment to enable building of xz_probe() and xz_probe_tail(). */
+/* #define XZ_DEC_PROBE */
+
+/* Uncomment to enable building of xz_dec_set_event_cb(). */
+/* #define XZ_DEC_EVENTS */
+
+/* Uncomment to enable building of xz_dec_run_iov(). */
+/* #define XZ_DEC_IOV */
+
+/* Uncomment to enable building of xz_dec_save() and xz_dec_restore(). */
+/* #define XZ_DEC_SAVE */
+
+/* Uncomment to enable building of xz_dec_set_flush() and xz_dec_held(). */
+/* #define XZ_DEC_FLUSH */
+
+/*
+ * Uncomment to enable building of xz_dec_get_stats(). This makes
+ * the LZMA2 decoder slower.
+ */
+/* #define XZ_DEC_STATS */
+
+/*
+ * Uncomment to enable the USDT probes for tracing tools like bpftrace.
+ * This needs <sys/sdt.h> from SystemTap.
+ */
+/* #define XZ_USE_SDT */
+
 /* Uncomment to enable CRC64 support. */
 /* #define XZ_USE_CRC64 */
 
+/* Uncomment to enable the Delta filter decoder. */
+/* #define XZ_DEC_DELTA */
+
 /* Uncomment as needed to enable BCJ filter decoders. */
 /* #define XZ_DEC_X86 */
 /* #define XZ_DEC_ARM */
@@ -25,6 +58,30 @@
 /* #define XZ_DEC_IA64 */
 /* #define XZ_DEC_SPARC */
 
+/*
+ * The x86, ARM64, and RISC-V BCJ filters have SSE2 and AVX2 versions of
+ * their opcode scanning loops. SSE2 is used when the compiler targets
+ * a processor that supports it (it is always available on x86-64).
+ * With GCC and Clang, AVX2 is used if the processor supports it at
+ * runtime. Uncomment to use only the portable C code.
+ */
+/* #define XZ_NO_SIMD */
+
+/*
+ * Uncomment to detect the processor features with xz_cpu.c. Then the AVX2
+ * code uses its result, and CRC32, CRC64, and SHA-256 use CLMUL and SHA
+ * instructions when the processor supports them. The environment variable
+ * XZ_CPU_FEATURES can be set to a comma-separated list of features (avx2,
+ * clmul, sha) to disable the features that aren't in the list.
+ */
+/* #define XZ_USE_DISPATCH */
+
+/*
+ * Uncomment to build the io_uring I/O driver in xz_uring.c. It needs
+ * Linux 5.6 or later at runtime.
+ */
+/* #define XZ_USE_URING */
+
 /*
  * Visual Studio 2013 update 2 supports only __inline, not inline.
  * MSVC v19.0 / VS 2015 and newer support both.
@@ -123,6 +180,111 @@ static inline void put_unaligned_be32(uint32_t val, uint8_t *buf)
 }
 #endif
 
+#ifndef XZ_NO_SIMD
+#	if defined(__SSE2__) || defined(_M_X64) \
+			|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#		define XZ_SIMD_SSE2
+#		include <emmintrin.h>
+#	endif
+/*
+ * The AVX2 code is built with a function attribute so that it can be used
+ * if the processor supports AVX2 even when the rest of the code is built
+ * for baseline x86-64. xz_simd_avx2() tells if AVX2 can be used.
+ */
+#	if defined(XZ_SIMD_SSE2) && (defined(__AVX2__) \
+			|| (defined(__GNUC__) && __GNUC__ >= 5) \
+			|| defined(__clang__))
+#		define XZ_SIMD_AVX2
+#		include <immintrin.h>
+#		ifdef __AVX2__
+#			define XZ_SIMD_AVX2_FUNC
+#			define xz_simd_avx2() true
+#		else
+#			define XZ_SIMD_AVX2_FUNC \
+				__attribute__((__target__("avx2")))
+#			ifdef XZ_USE_DISPATCH
+#				define xz_simd_avx2() xz_cpu_has(XZ_CPU_AVX2)
+#			else
+#				define xz_simd_avx2() \
+					(__builtin_cpu_supports("avx2") != 0)
+#			endif
+#		endif
+#	endif
+/*
+ * The CLMUL and SHA code is built only when the dispatching is enabled
+ * because these instructions are rarely enabled at compile time.
+ */
+#	if defined(XZ_USE_DISPATCH) && defined(XZ_SIMD_SSE2) \
+			&& ((defined(__GNUC__) && __GNUC__ >= 5) \
+				|| defined(__clang__))
+#		define XZ_SIMD_CLMUL
+#		define XZ_SIMD_CLMUL_FUNC \
+			__attribute__((__target__("sse2,pclmul")))
+#		define XZ_SIMD_SHA
+#		define XZ_SIMD_SHA_FUNC \
+			__attribute__((__target__("sse4.1,sha")))
+#		include <immintrin.h>
+#	endif
+#endif
+
+#ifdef XZ_USE_DISPATCH
+/*
+ * Processor features that are detected at runtime. SSE2 isn't included
+ * because its use is decided at compile time.
+ */
+#	define XZ_CPU_AVX2 0x01
+#	define XZ_CPU_CLMUL 0x02
+#	define XZ_CPU_SHA 0x04
+
+/*
+ * Get the XZ_CPU_* flags of the features that the processor supports
+ * and that aren't disabled with the XZ_CPU_FEATURES environment variable.
+ */
+XZ_EXTERN uint32_t xz_cpu_features(void);
+
+#	define xz_cpu_has(feature) ((xz_cpu_features() & (feature)) != 0)
+#endif
+
+#ifdef XZ_USE_URING
+struct xz_uring;
+
+/*
+ * Allocate the buffers and the io_uring instance and start reading from
+ * in_fd. Return NULL and set errno if io_uring can't be used.
+ */
+XZ_EXTERN struct xz_uring *xz_uring_init(int in_fd, int out_fd);
+
+/*
+ * Decode from in_fd to out_fd in multi-call mode until xz_dec_catrun()
+ * returns something other than XZ_OK. The return value of the decoder
+ * is stored in *ret. After XZ_UNSUPPORTED_CHECK this can be called again
+ * to continue. Return 0 on success and -1 with errno set on I/O error.
+ */
+XZ_EXTERN int xz_uring_run(struct xz_uring *u, struct xz_dec *s,
+			   enum xz_ret *ret);
+
+/* Cancel a pending read and free everything. u may be NULL. */
+XZ_EXTERN void xz_uring_end(struct xz_uring *u);
+#endif
+
+#ifdef XZ_SIMD_SSE2
+/*
+ * Get the index of the lowest set bit. This is used with the bitmasks from
+ * _mm_movemask_epi8() so x is never zero.
+ */
+#	ifdef _MSC_VER
+#		include <intrin.h>
+static inline uint32_t simd_ctz32(uint32_t x)
+{
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return i;
+}
+#	else
+#		define simd_ctz32(x) ((uint32_t)__builtin_ctz(x))
+#	endif
+#endif
+
 /*
  * To keep things simpler, use the generic unaligned methods also for
  * aligned access. The only place where performance could matter is
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Runtime detection of processor features for userspace builds
+ */
+
+#include "xz_config.h"
+
+#ifdef XZ_USE_DISPATCH
+
+#if defined(XZ_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#	include <cpuid.h>
+#	define CPU_X86_CPUID
+#endif
+
+static const struct {
+	const char *name;
+	uint32_t feature;
+} cpu_feature_names[] = {
+	{ "avx2", XZ_CPU_AVX2 },
+	{ "clmul", XZ_CPU_CLMUL },
+	{ "sha", XZ_CPU_SHA }
+};
+
+static uint32_t cpu_detect(void)
+{
+	uint32_t features = 0;
+#ifdef CPU_X86_CPUID
+	unsigned int eax;
+	unsigned int ebx;
+	unsigned int ecx;
+	unsigned int edx;
+	unsigned int ecx1;
+	unsigned int xcr0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+		return 0;
+
+	/* PCLMULQDQ */
+	if (ecx1 & (1U << 1))
+		features |= XZ_CPU_CLMUL;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return features;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	/* SHA needs SSSE3 and SSE4.1 too. */
+	if ((ebx & (1U << 29)) && (ecx1 & (1U << 9)) && (ecx1 & (1U << 19)))
+		features |= XZ_CPU_SHA;
+
+	/*
+	 * AVX2 needs AVX and the operating system has to save
+	 * the YMM registers (OSXSAVE and bits 1-2 in XCR0).
+	 */
+	if ((ebx & (1U << 5)) && (ecx1 & (1U << 27)) && (ecx1 & (1U << 28))) {
+		__asm__("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+		if ((xcr0 & 6) == 6)
+			features |= XZ_CPU_AVX2;
+	}
+#endif
+
+	return features;
+}
+
+/* Parse a comma-separated list of feature names. */
+static uint32_t cpu_parse(const char *str)
+{
+	uint32_t features = 0;
+	size_t len;
+	size_t i;
+
+	while (*str != '\0') {
+		len = strcspn(str, ",");
+
+		for (i = 0; i < sizeof(cpu_feature_names)
+				/ sizeof(cpu_feature_names[0]); ++i)
+			if (strlen(cpu_feature_names[i].name) == len
+					&& memeq(cpu_feature_names[i].name,
+						 str, len))
+				features |= cpu_feature_names[i].feature;
+
+		str += len;
+		if (*str == ',')
+			++str;
+	}
+
+	return features;
+}
+
+/*
+ * The features are detected on the first call. xz_crc32_init() calls this
+ * function so this happens before the decoder can be used from multiple
+ * threads.
+ */
+XZ_EXTERN uint32_t xz_cpu_features(void)
+{
+	static bool detected = false;
+	static uint32_t features;
+	const char *env;
+
+	if (!detected) {
+		features = cpu_detect();
+
+		env = getenv("XZ_CPU_FEATURES");
+		if (env != NULL)
+			features &= cpu_parse(env);
+
+		detected = true;
+	}
+
+	return features;
+}
+
+#endif
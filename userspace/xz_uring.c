@@ -0,0 +1,420 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Asynchronous I/O with io_uring for multi-call decoding on Linux
+ *
+ * There are two input and two output buffers. While the decoder uses one
+ * of each, the next input buffer is being read and the previous output
+ * buffer is being written by the kernel. At most one read and one write
+ * are in flight at a time, and they use the current file position like
+ * read() and write() do, so pipes and regular files both work.
+ *
+ * The system calls are used directly so that liburing isn't needed.
+ */
+
+#include "xz_config.h"
+
+#ifdef XZ_USE_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Size of each of the four buffers */
+#define URING_BUF_SIZE (256U << 10)
+
+/* A read, a write, and a cancel request fit in the ring. */
+#define URING_ENTRIES 4
+
+/* The user_data values of the requests */
+enum uring_tag {
+	URING_READ,
+	URING_WRITE,
+	URING_CANCEL,
+	URING_TAGS
+};
+
+struct xz_uring {
+	int fd;
+	int in_fd;
+	int out_fd;
+
+	/* Submission queue */
+	void *sq_ring;
+	size_t sq_ring_size;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/* Completion queue, possibly in the same mapping as sq_ring */
+	void *cq_ring;
+	size_t cq_ring_size;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Requests that haven't completed and the results of the others */
+	bool busy[URING_TAGS];
+	int32_t res[URING_TAGS];
+
+	/*
+	 * in[0] and out[0] are used by the decoder. in[1] is being read
+	 * and out[1] is being written. buf is the allocation that they
+	 * all are in.
+	 */
+	uint8_t *buf;
+	uint8_t *in[2];
+	uint8_t *out[2];
+
+	/* The part of out[1] that has been written and its total size */
+	size_t write_pos;
+	size_t write_size;
+
+	/* True once a read has returned zero bytes */
+	bool eof;
+
+	struct xz_buf b;
+};
+
+static void *uring_map(int fd, size_t size, off_t offset)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, offset);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* Free everything in u that has been allocated. errno is kept. */
+static void uring_free(struct xz_uring *u)
+{
+	int saved_errno = errno;
+
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+
+	if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+
+	if (u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+
+	if (u->fd >= 0)
+		close(u->fd);
+
+	free(u->buf);
+	free(u);
+	errno = saved_errno;
+}
+
+/*
+ * Queue a request and submit it. off is -1 to use the file position.
+ * For IORING_OP_ASYNC_CANCEL, addr is the user_data of the request
+ * to cancel.
+ */
+static bool uring_submit(struct xz_uring *u, uint8_t opcode,
+			 enum uring_tag tag, int fd, uint64_t addr,
+			 uint32_t len)
+{
+	uint32_t tail = *u->sq_tail;
+	uint32_t i = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[i];
+
+	memzero(sqe, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = addr;
+	sqe->len = len;
+	sqe->user_data = tag;
+
+	u->sq_array[i] = i;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0) < 0) {
+		/* The entry wasn't consumed so take it back. */
+		__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	u->busy[tag] = true;
+	return true;
+}
+
+/* Reap completions until the request tag has completed. */
+static bool uring_wait(struct xz_uring *u, enum uring_tag tag)
+{
+	struct io_uring_cqe *cqe;
+	uint32_t head;
+
+	while (u->busy[tag]) {
+		head = *u->cq_head;
+		if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (syscall(__NR_io_uring_enter, u->fd, 0, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0) < 0
+					&& errno != EINTR)
+				return false;
+
+			continue;
+		}
+
+		cqe = &u->cqes[head & *u->cq_mask];
+		if (cqe->user_data < URING_TAGS) {
+			u->res[cqe->user_data] = cqe->res;
+			u->busy[cqe->user_data] = false;
+		}
+
+		__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return true;
+}
+
+static bool submit_read(struct xz_uring *u)
+{
+	return uring_submit(u, IORING_OP_READ, URING_READ, u->in_fd,
+			(uintptr_t)u->in[1], URING_BUF_SIZE);
+}
+
+static bool submit_write(struct xz_uring *u)
+{
+	return uring_submit(u, IORING_OP_WRITE, URING_WRITE, u->out_fd,
+			(uintptr_t)(u->out[1] + u->write_pos),
+			(uint32_t)(u->write_size - u->write_pos));
+}
+
+/*
+ * Wait for the next input buffer, give it to the decoder, and start
+ * reading into the one that the decoder used up.
+ */
+static bool next_input(struct xz_uring *u)
+{
+	uint8_t *tmp;
+
+	if (!uring_wait(u, URING_READ))
+		return false;
+
+	if (u->res[URING_READ] < 0) {
+		errno = -u->res[URING_READ];
+		return false;
+	}
+
+	tmp = u->in[0];
+	u->in[0] = u->in[1];
+	u->in[1] = tmp;
+
+	u->b.in = u->in[0];
+	u->b.in_pos = 0;
+	u->b.in_size = (size_t)u->res[URING_READ];
+
+	if (u->b.in_size == 0) {
+		u->eof = true;
+		return true;
+	}
+
+	return submit_read(u);
+}
+
+/*
+ * Wait until all of out[1] has been written. While any of it is left,
+ * there is one write whose result hasn't been handled yet. It may have
+ * been reaped already when waiting for a read.
+ */
+static bool finish_write(struct xz_uring *u)
+{
+	while (u->write_pos < u->write_size) {
+		if (!uring_wait(u, URING_WRITE))
+			return false;
+
+		if (u->res[URING_WRITE] <= 0) {
+			errno = u->res[URING_WRITE] < 0
+					? -u->res[URING_WRITE] : EIO;
+			return false;
+		}
+
+		u->write_pos += (size_t)u->res[URING_WRITE];
+		if (u->write_pos < u->write_size && !submit_write(u))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Wait for the previous output buffer to be written, start writing
+ * the current one, and give the previous one to the decoder.
+ */
+static bool next_output(struct xz_uring *u)
+{
+	uint8_t *tmp;
+
+	if (!finish_write(u))
+		return false;
+
+	tmp = u->out[0];
+	u->out[0] = u->out[1];
+	u->out[1] = tmp;
+
+	u->write_pos = 0;
+	u->write_size = u->b.out_pos;
+
+	u->b.out = u->out[0];
+	u->b.out_pos = 0;
+
+	return u->write_size == 0 || submit_write(u);
+}
+
+XZ_EXTERN struct xz_uring *xz_uring_init(int in_fd, int out_fd)
+{
+	struct io_uring_params p;
+	struct xz_uring *u;
+	size_t size;
+
+	u = calloc(1, sizeof(*u));
+	if (u == NULL)
+		return NULL;
+
+	memzero(&p, sizeof(p));
+	u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (u->fd < 0)
+		goto error;
+
+	/*
+	 * IORING_OP_READ and IORING_OP_WRITE with the file position
+	 * need Linux 5.6. The feature flag is the easiest way to know.
+	 */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		errno = ENOSYS;
+		goto error;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	u->cq_ring_size = p.cq_off.cqes
+			+ p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		size = u->sq_ring_size > u->cq_ring_size
+				? u->sq_ring_size : u->cq_ring_size;
+		u->sq_ring_size = size;
+		u->cq_ring_size = size;
+	}
+
+	u->sq_ring = uring_map(u->fd, u->sq_ring_size, IORING_OFF_SQ_RING);
+	if (u->sq_ring == NULL)
+		goto error;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ring = u->sq_ring;
+	else
+		u->cq_ring = uring_map(u->fd, u->cq_ring_size,
+				IORING_OFF_CQ_RING);
+
+	if (u->cq_ring == NULL)
+		goto error;
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = uring_map(u->fd, u->sqes_size, IORING_OFF_SQES);
+	if (u->sqes == NULL)
+		goto error;
+
+	u->sq_tail = (uint32_t *)((uint8_t *)u->sq_ring + p.sq_off.tail);
+	u->sq_mask = (uint32_t *)((uint8_t *)u->sq_ring
+			+ p.sq_off.ring_mask);
+	u->sq_array = (uint32_t *)((uint8_t *)u->sq_ring + p.sq_off.array);
+
+	u->cq_head = (uint32_t *)((uint8_t *)u->cq_ring + p.cq_off.head);
+	u->cq_tail = (uint32_t *)((uint8_t *)u->cq_ring + p.cq_off.tail);
+	u->cq_mask = (uint32_t *)((uint8_t *)u->cq_ring
+			+ p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((uint8_t *)u->cq_ring
+			+ p.cq_off.cqes);
+
+	u->buf = malloc(4 * URING_BUF_SIZE);
+	if (u->buf == NULL)
+		goto error;
+
+	u->in[0] = u->buf;
+	u->in[1] = u->buf + URING_BUF_SIZE;
+	u->out[0] = u->buf + 2 * URING_BUF_SIZE;
+	u->out[1] = u->buf + 3 * URING_BUF_SIZE;
+
+	u->in_fd = in_fd;
+	u->out_fd = out_fd;
+
+	u->b.in = u->in[0];
+	u->b.in_pos = 0;
+	u->b.in_size = 0;
+	u->b.out = u->out[0];
+	u->b.out_pos = 0;
+	u->b.out_size = URING_BUF_SIZE;
+
+	if (!submit_read(u))
+		goto error;
+
+	return u;
+
+error:
+	uring_free(u);
+	return NULL;
+}
+
+XZ_EXTERN int xz_uring_run(struct xz_uring *u, struct xz_dec *s,
+			   enum xz_ret *ret)
+{
+	do {
+		if (u->b.in_pos == u->b.in_size && !u->eof
+				&& !next_input(u))
+			return -1;
+
+		*ret = xz_dec_catrun(s, &u->b, u->eof);
+
+		/*
+		 * Unless the decoder only reported an unsupported check,
+		 * its output is written out also when it stops, which is
+		 * what the stdio loop in xzminidec does too.
+		 */
+		if ((u->b.out_pos == u->b.out_size
+				|| (*ret != XZ_OK
+					&& *ret != XZ_UNSUPPORTED_CHECK))
+				&& !next_output(u))
+			return -1;
+	} while (*ret == XZ_OK);
+
+	if (*ret != XZ_UNSUPPORTED_CHECK && !finish_write(u))
+		return -1;
+
+	return 0;
+}
+
+XZ_EXTERN void xz_uring_end(struct xz_uring *u)
+{
+	if (u == NULL)
+		return;
+
+	/*
+	 * A read from a pipe or a terminal may never complete on its own
+	 * so it is cancelled. If the cancellation fails, the read may
+	 * still write into in[1] later, so the buffers are then leaked
+	 * instead of freed.
+	 */
+	if (u->busy[URING_READ]) {
+		if (!uring_submit(u, IORING_OP_ASYNC_CANCEL, URING_CANCEL,
+				-1, URING_READ, 0)
+				|| !uring_wait(u, URING_CANCEL)
+				|| (u->res[URING_CANCEL] != 0
+					&& u->res[URING_CANCEL] != -ENOENT)
+				|| !uring_wait(u, URING_READ))
+			u->buf = NULL;
+	}
+
+	/* Writes complete eventually. The result doesn't matter anymore. */
+	if (u->busy[URING_WRITE] && !uring_wait(u, URING_WRITE))
+		u->buf = NULL;
+
+	uring_free(u);
+}
+
+#endif
@@ -0,0 +1,785 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Decompression speed benchmark
+ *
+ * Each .xz file given on the command line is loaded into memory and
+ * decompressed with each decoder mode and, in the multi-call modes, with
+ * input and output buffers of 1 byte up to the whole file. The results
+ * are written to stdout as JSON with a fixed layout so that the output
+ * of two builds can be compared with a script.
+ *
+ * Use a corpus that has files with each check type and BCJ filter that
+ * matters. The check type and the filters of the first Block of each
+ * file are included in the results.
+ *
+ * With -i and -o, the input and output buffer sizes of the multi-call
+ * modes are instead picked from distributions like "1500:9,9000:1" (a
+ * size and its weight), such as network packet sizes and page sizes.
+ * Each call to the decoder is timed, and the percentiles of the times
+ * are reported with the throughput. The sizes are picked with a fixed
+ * seed, so every run feeds the decoder the same way. All the times are
+ * kept in memory, four bytes per call.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "xz_config.h"
+
+#ifndef _WIN32
+#	include <sys/resource.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#	include <x86intrin.h>
+#	define HAVE_RDTSC
+#endif
+
+/* Buffer sizes used in the multi-call modes. 0 means the whole file. */
+static const size_t buf_sizes[] = {
+	1, 16, 256, 4096, 65536, 1024 * 1024, 0
+};
+
+static const struct {
+	enum xz_mode mode;
+	const char *name;
+} modes[] = {
+	{ XZ_SINGLE, "single" },
+	{ XZ_PREALLOC, "prealloc" },
+	{ XZ_DYNALLOC, "dynalloc" }
+};
+
+struct file {
+	const char *name;
+	uint8_t *in;
+	size_t in_size;
+	uint8_t *out;
+	size_t out_size;
+	uint32_t dict_max;
+	struct xz_info info;
+};
+
+struct result {
+	unsigned long runs;
+	double seconds;
+	uint64_t ticks;
+	uint64_t memusage;
+	uint64_t memusage_peak;
+};
+
+/* Maximum number of sizes in a chunk size distribution */
+#define DIST_MAX 16
+
+/*
+ * Chunk size distribution for the latency mode. weights[] are cumulative
+ * so weights[count - 1] is the total.
+ */
+struct dist {
+	const char *str;
+	size_t count;
+	size_t sizes[DIST_MAX];
+	uint32_t weights[DIST_MAX];
+	size_t max;
+};
+
+/* Times of the decoder calls in nanoseconds */
+struct latencies {
+	uint32_t *ns;
+	size_t count;
+	size_t alloc;
+};
+
+/* Minimum time to spend on each measurement */
+static double min_seconds = 0.5;
+
+/* The latency mode is used if -i or -o is given. */
+static bool latency_mode;
+static struct dist in_dist;
+static struct dist out_dist;
+
+/* State of the random number generator used to pick the chunk sizes */
+static uint64_t rng;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t ticks(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Monotonic time in nanoseconds for timing single decoder calls */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+#ifdef _WIN32
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64* like in xzgen.c */
+static uint32_t rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return (uint32_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 32);
+}
+
+/*
+ * Parse a comma-separated list of SIZE[:WEIGHT] into d. The default
+ * weight is 1.
+ */
+static bool parse_dist(struct dist *d, const char *str)
+{
+	const char *p = str;
+	char *end;
+	unsigned long size;
+	unsigned long weight;
+	uint32_t total = 0;
+
+	d->str = str;
+	d->count = 0;
+	d->max = 0;
+
+	do {
+		if (d->count == DIST_MAX)
+			return false;
+
+		size = strtoul(p, &end, 0);
+		if (end == p || size == 0 || size > (1UL << 30))
+			return false;
+
+		weight = 1;
+		if (*end == ':') {
+			p = end + 1;
+			weight = strtoul(p, &end, 0);
+			if (end == p || weight == 0 || weight > (1UL << 20))
+				return false;
+		}
+
+		if (*end != ',' && *end != '\0')
+			return false;
+
+		total += (uint32_t)weight;
+		d->sizes[d->count] = size;
+		d->weights[d->count] = total;
+		++d->count;
+
+		if (d->max < size)
+			d->max = size;
+
+		p = end + 1;
+	} while (*end == ',');
+
+	return true;
+}
+
+/* Pick a size from the distribution. */
+static size_t pick(const struct dist *d)
+{
+	uint32_t r = (uint32_t)(((uint64_t)rnd()
+			* d->weights[d->count - 1]) >> 32);
+	size_t i = 0;
+
+	while (d->weights[i] <= r)
+		++i;
+
+	return d->sizes[i];
+}
+
+static bool load(struct file *f, const char *name)
+{
+	FILE *file;
+	size_t alloc = 1024 * 1024;
+	size_t n;
+
+	f->name = name;
+	f->in = NULL;
+	f->in_size = 0;
+
+	file = fopen(name, "rb");
+	if (file == NULL)
+		return false;
+
+	do {
+		alloc *= 2;
+		f->in = realloc(f->in, alloc);
+		if (f->in == NULL) {
+			fclose(file);
+			return false;
+		}
+
+		n = fread(f->in + f->in_size, 1, alloc - f->in_size, file);
+		f->in_size += n;
+	} while (f->in_size == alloc);
+
+	if (ferror(file)) {
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	f->info.check = 0;
+	f->info.bcj_id = 0;
+	f->info.delta_distance = 0;
+	xz_probe(f->in, f->in_size, &f->info);
+
+	return true;
+}
+
+/*
+ * Decompress the file once in XZ_DYNALLOC mode to get the uncompressed
+ * size, which XZ_SINGLE needs, and the biggest dictionary, which
+ * XZ_PREALLOC needs.
+ */
+static enum xz_ret prepare(struct file *f)
+{
+	struct xz_dec *s;
+	struct xz_buf b;
+	enum xz_ret ret;
+	size_t alloc = f->in_size * 4 + 4096;
+
+	s = xz_dec_init(XZ_DYNALLOC, (uint32_t)-1);
+	if (s == NULL)
+		return XZ_MEM_ERROR;
+
+	f->out = NULL;
+
+	b.in = f->in;
+	b.in_pos = 0;
+	b.in_size = f->in_size;
+	b.out = NULL;
+	b.out_pos = 0;
+	b.out_size = 0;
+
+	do {
+		if (b.out_pos == b.out_size) {
+			alloc *= 2;
+			f->out = realloc(f->out, alloc);
+			if (f->out == NULL) {
+				ret = XZ_MEM_ERROR;
+				break;
+			}
+
+			b.out = f->out;
+			b.out_size = alloc;
+		}
+
+		ret = xz_dec_catrun(s, &b, true);
+	} while (ret == XZ_OK || ret == XZ_UNSUPPORTED_CHECK);
+
+	f->out_size = b.out_pos;
+	f->dict_max = (uint32_t)(xz_dec_memusage_of(s)
+			- xz_dec_memusage(XZ_DYNALLOC, 0));
+	xz_dec_end(s);
+
+	return ret;
+}
+
+/* Decompress the file once. Return false on error. */
+static bool decode(struct xz_dec *s, const struct file *f, size_t buf_size)
+{
+	struct xz_buf b;
+	enum xz_ret ret;
+	bool finish;
+
+	if (buf_size == 0 || buf_size > f->in_size) {
+		b.in_size = f->in_size;
+		finish = true;
+	} else {
+		b.in_size = buf_size;
+		finish = false;
+	}
+
+	b.in = f->in;
+	b.in_pos = 0;
+	b.out = f->out;
+	b.out_pos = 0;
+	b.out_size = buf_size == 0 ? f->out_size : buf_size;
+
+	xz_dec_reset(s);
+
+	while (true) {
+		ret = xz_dec_catrun(s, &b, finish);
+		if (ret == XZ_STREAM_END)
+			break;
+
+		if (ret != XZ_OK && ret != XZ_UNSUPPORTED_CHECK)
+			return false;
+
+		if (b.in_pos == b.in_size) {
+			b.in_size += buf_size;
+			if (b.in_size >= f->in_size) {
+				b.in_size = f->in_size;
+				finish = true;
+			}
+		}
+
+		/*
+		 * With small buffers the same part of f->out is overwritten
+		 * again and again, so the output stays in the cache like
+		 * it would in a real streaming application.
+		 */
+		if (b.out_pos == b.out_size)
+			b.out_pos = 0;
+	}
+
+	return true;
+}
+
+static bool measure(const struct file *f, enum xz_mode mode,
+		    size_t buf_size, struct result *r)
+{
+	struct xz_dec *s;
+	double start;
+	uint64_t start_ticks;
+
+	s = xz_dec_init(mode, f->dict_max);
+	if (s == NULL)
+		return false;
+
+	r->runs = 0;
+	start = now();
+	start_ticks = ticks();
+
+	do {
+		if (!decode(s, f, buf_size)) {
+			xz_dec_end(s);
+			return false;
+		}
+
+		++r->runs;
+		r->seconds = now() - start;
+	} while (r->seconds < min_seconds);
+
+	r->ticks = ticks() - start_ticks;
+	r->memusage = xz_dec_memusage_of(s);
+	r->memusage_peak = xz_dec_memusage_peak(s);
+	xz_dec_end(s);
+
+	return true;
+}
+
+static bool latencies_add(struct latencies *lat, uint64_t ns)
+{
+	uint32_t *ptr;
+
+	if (lat->count == lat->alloc) {
+		lat->alloc = lat->alloc == 0 ? 4096 : lat->alloc * 2;
+		ptr = realloc(lat->ns, lat->alloc * sizeof(*lat->ns));
+		if (ptr == NULL)
+			return false;
+
+		lat->ns = ptr;
+	}
+
+	lat->ns[lat->count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+	return true;
+}
+
+/*
+ * Decompress the file once with chunk sizes picked from in_dist and
+ * out_dist, and time each call of the decoder. out must have room for
+ * out_dist.max bytes. Return false on error.
+ */
+static bool decode_chunked(struct xz_dec *s, const struct file *f,
+			   uint8_t *out, struct latencies *lat)
+{
+	struct xz_buf b;
+	enum xz_ret ret;
+	bool finish = false;
+	uint64_t start;
+
+	rng = 1;
+
+	b.in = f->in;
+	b.in_pos = 0;
+	b.in_size = 0;
+	b.out = out;
+	b.out_pos = 0;
+	b.out_size = pick(&out_dist);
+
+	xz_dec_reset(s);
+
+	while (true) {
+		if (b.in_pos == b.in_size && !finish) {
+			b.in_size += pick(&in_dist);
+			if (b.in_size >= f->in_size) {
+				b.in_size = f->in_size;
+				finish = true;
+			}
+		}
+
+		start = now_ns();
+		ret = xz_dec_catrun(s, &b, finish);
+		if (!latencies_add(lat, now_ns() - start))
+			return false;
+
+		if (ret == XZ_STREAM_END)
+			break;
+
+		if (ret != XZ_OK && ret != XZ_UNSUPPORTED_CHECK)
+			return false;
+
+		if (b.out_pos == b.out_size) {
+			b.out_pos = 0;
+			b.out_size = pick(&out_dist);
+		}
+	}
+
+	return true;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static bool measure_latency(const struct file *f, enum xz_mode mode,
+			    struct result *r, struct latencies *lat)
+{
+	struct xz_dec *s;
+	uint8_t *out;
+	double start;
+
+	out = malloc(out_dist.max);
+	if (out == NULL)
+		return false;
+
+	s = xz_dec_init(mode, f->dict_max);
+	if (s == NULL) {
+		free(out);
+		return false;
+	}
+
+	lat->count = 0;
+	r->runs = 0;
+	start = now();
+
+	do {
+		if (!decode_chunked(s, f, out, lat)) {
+			xz_dec_end(s);
+			free(out);
+			return false;
+		}
+
+		++r->runs;
+		r->seconds = now() - start;
+	} while (r->seconds < min_seconds);
+
+	r->memusage = xz_dec_memusage_of(s);
+	r->memusage_peak = xz_dec_memusage_peak(s);
+	xz_dec_end(s);
+	free(out);
+
+	qsort(lat->ns, lat->count, sizeof(*lat->ns), &cmp_u32);
+	return true;
+}
+
+/* Get the time that permille per mille of the calls didn't exceed. */
+static uint32_t percentile(const struct latencies *lat, unsigned permille)
+{
+	return lat->ns[(lat->count - 1) * permille / 1000];
+}
+
+static void print_latency(const struct file *f, const char *mode,
+			  const struct result *r,
+			  const struct latencies *lat)
+{
+	double bytes = (double)f->out_size * r->runs;
+
+	printf("\t\t\t\t{ \"mode\": \"%s\", \"runs\": %lu, "
+			"\"seconds\": %.6f, \"mb_per_s\": %.2f, ",
+			mode, r->runs, r->seconds, bytes / r->seconds / 1e6);
+	printf("\"calls\": %zu, \"latency_ns\": { \"min\": %u, "
+			"\"p50\": %u, \"p90\": %u, \"p99\": %u, "
+			"\"p999\": %u, \"max\": %u }, ",
+			lat->count, lat->ns[0], percentile(lat, 500),
+			percentile(lat, 900), percentile(lat, 990),
+			percentile(lat, 999), lat->ns[lat->count - 1]);
+	printf("\"memusage\": %llu, \"memusage_peak\": %llu }",
+			(unsigned long long)r->memusage,
+			(unsigned long long)r->memusage_peak);
+}
+
+static void print_result(const struct file *f, const char *mode,
+			 size_t buf_size, const struct result *r)
+{
+	double bytes = (double)f->out_size * r->runs;
+
+	if (buf_size == 0)
+		buf_size = f->out_size > f->in_size
+				? f->out_size : f->in_size;
+
+	printf("\t\t\t\t{ \"mode\": \"%s\", \"buf_size\": %zu, "
+			"\"runs\": %lu, \"seconds\": %.6f, ",
+			mode, buf_size, r->runs, r->seconds);
+	printf("\"mb_per_s\": %.2f, ", bytes / r->seconds / 1e6);
+
+#ifdef HAVE_RDTSC
+	printf("\"cycles_per_byte\": %.3f, ",
+			bytes > 0 ? r->ticks / bytes : 0.0);
+#else
+	printf("\"cycles_per_byte\": null, ");
+#endif
+
+	printf("\"memusage\": %llu, \"memusage_peak\": %llu }",
+			(unsigned long long)r->memusage,
+			(unsigned long long)r->memusage_peak);
+}
+
+/*
+ * Print str as a JSON string. Quotes, backslashes, and control characters
+ * are escaped. Other bytes are printed as is, so a file name that isn't
+ * valid UTF-8 stays invalid.
+ */
+static void print_string(const char *str)
+{
+	putchar('"');
+
+	for (; *str != '\0'; ++str) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04X", (unsigned char)*str);
+		else
+			putchar(*str);
+	}
+
+	putchar('"');
+}
+
+static bool bench_file(const char *name, bool first_file)
+{
+	struct file f;
+	struct result r;
+	struct latencies lat = { NULL, 0, 0 };
+	size_t i;
+	size_t j;
+	enum xz_ret ret;
+	bool first = true;
+
+	if (!load(&f, name)) {
+		fprintf(stderr, "%s: Cannot read the file\n", name);
+		return false;
+	}
+
+	ret = prepare(&f);
+	if (ret != XZ_STREAM_END) {
+		fprintf(stderr, "%s: Decompression failed (%d)\n", name, ret);
+		free(f.in);
+		free(f.out);
+		return false;
+	}
+
+	printf("%s\t\t{\n\t\t\t\"name\": ", first_file ? "" : ",\n");
+	print_string(name);
+	printf(",\n"
+			"\t\t\t\"compressed\": %zu,\n"
+			"\t\t\t\"uncompressed\": %zu,\n"
+			"\t\t\t\"check\": %u,\n"
+			"\t\t\t\"bcj\": %u,\n"
+			"\t\t\t\"delta\": %u,\n"
+			"\t\t\t\"dict_size\": %u,\n"
+			"\t\t\t\"results\": [\n",
+			f.in_size, f.out_size, f.info.check,
+			f.info.bcj_id, f.info.delta_distance, f.dict_max);
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		if (latency_mode) {
+			if (modes[i].mode == XZ_SINGLE)
+				continue;
+
+			if (!measure_latency(&f, modes[i].mode, &r, &lat)) {
+				fprintf(stderr, "%s: Decompression failed "
+						"in %s mode\n",
+						name, modes[i].name);
+				continue;
+			}
+
+			if (!first)
+				fputs(",\n", stdout);
+
+			first = false;
+			print_latency(&f, modes[i].name, &r, &lat);
+			fflush(stdout);
+			continue;
+		}
+
+		for (j = 0; j < sizeof(buf_sizes) / sizeof(buf_sizes[0]);
+				++j) {
+			/* Single-call mode needs whole-file buffers. */
+			if (modes[i].mode == XZ_SINGLE && buf_sizes[j] != 0)
+				continue;
+
+			if (!measure(&f, modes[i].mode, buf_sizes[j], &r)) {
+				fprintf(stderr, "%s: Decompression failed "
+						"in %s mode\n",
+						name, modes[i].name);
+				continue;
+			}
+
+			if (!first)
+				fputs(",\n", stdout);
+
+			first = false;
+			print_result(&f, modes[i].name, buf_sizes[j], &r);
+			fflush(stdout);
+		}
+	}
+
+	printf("\n\t\t\t]\n\t\t}");
+
+	free(lat.ns);
+	free(f.in);
+	free(f.out);
+	return true;
+}
+
+#ifdef XZ_USE_DISPATCH
+/* The speed depends a lot on these so they are included in the results. */
+static void print_cpu_features(void)
+{
+	static const struct {
+		uint32_t feature;
+		const char *name;
+	} names[] = {
+		{ XZ_CPU_AVX2, "avx2" },
+		{ XZ_CPU_CLMUL, "clmul" },
+		{ XZ_CPU_SHA, "sha" }
+	};
+
+	const char *sep = "";
+	size_t i;
+
+	printf("\t\"cpu_features\": [");
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (xz_cpu_has(names[i].feature)) {
+			printf("%s\"%s\"", sep, names[i].name);
+			sep = ", ";
+		}
+	}
+
+	printf("],\n");
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	int i = 1;
+	bool first = true;
+	bool ok = true;
+#ifndef _WIN32
+	struct rusage usage;
+#endif
+
+	if (argc >= 2 && strcmp(argv[1], "--help") == 0) {
+		fputs("Usage: xzbench [-t SECONDS] [-i SIZES] [-o SIZES] "
+				"FILE.xz...\n"
+				"Measure the decompression speed of the files "
+				"with each decoder mode\nand buffer size. "
+				"Each measurement takes at least SECONDS "
+				"(default 0.5).\n"
+				"With -i or -o, pick the input and output "
+				"buffer sizes of the multi-call\nmodes from "
+				"SIZES, a list like `1500:9,9000:1' of sizes "
+				"and their\nweights, and report the "
+				"percentiles of the time of each decoder "
+				"call.\n"
+				"The default for the other one is 4096.\n"
+				"The results are written to stdout as JSON.\n",
+				stdout);
+		return 0;
+	}
+
+	while (i + 1 < argc && argv[i][0] == '-') {
+		if (strcmp(argv[i], "-t") == 0) {
+			min_seconds = atof(argv[i + 1]);
+		} else if (strcmp(argv[i], "-i") == 0) {
+			if (!parse_dist(&in_dist, argv[i + 1]))
+				break;
+
+			latency_mode = true;
+		} else if (strcmp(argv[i], "-o") == 0) {
+			if (!parse_dist(&out_dist, argv[i + 1]))
+				break;
+
+			latency_mode = true;
+		} else {
+			break;
+		}
+
+		i += 2;
+	}
+
+	if (i >= argc || argv[i][0] == '-') {
+		fputs("Usage: xzbench [-t SECONDS] [-i SIZES] [-o SIZES] "
+				"FILE.xz...\n", stderr);
+		return 1;
+	}
+
+	if (latency_mode) {
+		if (in_dist.count == 0)
+			parse_dist(&in_dist, "4096");
+
+		if (out_dist.count == 0)
+			parse_dist(&out_dist, "4096");
+	}
+
+	xz_crc32_init();
+#ifdef XZ_USE_CRC64
+	xz_crc64_init();
+#endif
+
+	printf("{\n");
+#ifdef XZ_USE_DISPATCH
+	print_cpu_features();
+#endif
+	if (latency_mode)
+		printf("\t\"in_sizes\": \"%s\",\n"
+				"\t\"out_sizes\": \"%s\",\n",
+				in_dist.str, out_dist.str);
+
+	printf("\t\"files\": [\n");
+
+	for (; i < argc; ++i) {
+		if (bench_file(argv[i], first))
+			first = false;
+		else
+			ok = false;
+	}
+
+	printf("\n\t],\n");
+
+#ifdef _WIN32
+	printf("\t\"peak_rss_kib\": null\n");
+#else
+	getrusage(RUSAGE_SELF, &usage);
+	printf("\t\"peak_rss_kib\": %ld\n", usage.ru_maxrss);
+#endif
+	printf("}\n");
+
+	return !ok;
+}
@@ -0,0 +1,1120 @@
+// SPDX-License-Identifier: 0BSD
+
+/*
+ * Generator of synthetic .xz files for benchmarking the decoder
+ *
+ * The LZMA2 data is made of randomly chosen literals, matches, and
+ * repeated matches in proportions given on the command line, so that
+ * the decoder can be timed on one kind of input at a time: only
+ * literals, only short-distance matches, uncompressed chunks, frequent
+ * state resets, and so on. Instead of searching for matches like a real
+ * encoder, the minimal encoder in this file picks the symbols first and
+ * then produces the uncompressed data that they decode to. The output
+ * depends only on the options and the seed. The percentage of literals
+ * applies after the first DICT_WARMUP bytes of each dictionary, which
+ * are all random literals so that the matches have varied data to copy.
+ *
+ * Match distances are picked so that the number of bits in them is
+ * uniformly distributed up to the maximum given with -d. Other
+ * distributions aren't supported.
+ *
+ * A BCJ filter and a Delta filter can be added to the filter chain.
+ * The generated data is then treated as if it had already been through
+ * the encoders of these filters, that is, the decoder applies the filters
+ * to it. The Block Check is computed from the data that the decoder
+ * produces, so for these Blocks it is computed by decoding the Block
+ * with XZ Embedded.
+ */
+
+#include <stdbool.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../linux/lib/xz/xz_private.h"
+
+#ifdef _WIN32
+#	include <io.h>
+#	include <fcntl.h>
+#endif
+
+/* Limits of LZMA2 chunks */
+#define CHUNK_UNCOMPRESSED_MAX (2 << 20)
+#define CHUNK_COMPRESSED_MAX (64 << 10)
+#define CHUNK_COPY_MAX (64 << 10)
+
+/*
+ * The first bytes after each dictionary reset are always literals.
+ * Otherwise with -l 0 the first match would copy the single literal
+ * that starts the dictionary and so would every match after it.
+ */
+#define DICT_WARMUP 4096
+
+/* Upper bound of the encoded size of one LZMA symbol */
+#define SYMBOL_SIZE_MAX 64
+
+#define STATES 12
+#define LIT_STATES 7
+#define POS_STATES_MAX 16
+#define MATCH_LEN_MIN 2
+#define MATCH_LEN_MAX 273
+#define DIST_STATES 4
+#define DIST_SLOTS 64
+#define DIST_MODEL_START 4
+#define DIST_MODEL_END 14
+#define FULL_DISTANCES 128
+#define ALIGN_BITS 4
+#define REPS 4
+
+/* The properties are always lc=3, lp=0, pb=2, which xz uses by default. */
+#define LZMA_LC 3
+#define LZMA_PB_MASK 3
+#define LZMA_PROPS ((2 * 5 + 0) * 9 + 3)
+
+enum check {
+	CHECK_NONE = 0,
+	CHECK_CRC32 = 1,
+	CHECK_CRC64 = 4,
+	CHECK_SHA256 = 10
+};
+
+/* Options given on the command line */
+static struct {
+	uint64_t seed;
+	size_t block_size;
+	unsigned int blocks;
+	unsigned int literal_pct;
+	unsigned int rep_pct;
+	uint32_t dist_max;
+	uint32_t len_max;
+	unsigned int alphabet;
+	unsigned int copy_pct;
+	uint32_t chunk_size;
+	unsigned int state_reset;
+	unsigned int dict_reset;
+	uint8_t bcj_id;
+	unsigned int delta_dist;
+	enum check check;
+} opt = {
+	.seed = 1,
+	.block_size = 1 << 20,
+	.blocks = 1,
+	.literal_pct = 50,
+	.rep_pct = 30,
+	.dist_max = UINT32_MAX,
+	.len_max = MATCH_LEN_MAX,
+	.alphabet = 256,
+	.copy_pct = 0,
+	.chunk_size = CHUNK_UNCOMPRESSED_MAX,
+	.state_reset = 0,
+	.dict_reset = 0,
+	.bcj_id = 0,
+	.delta_dist = 0,
+	.check = CHECK_CRC32
+};
+
+/* Growing output buffer */
+struct buf {
+	uint8_t *data;
+	size_t size;
+	size_t alloc;
+};
+
+struct rc_enc {
+	uint64_t low;
+	uint32_t range;
+	uint8_t cache;
+	size_t cache_size;
+	uint8_t out[CHUNK_COMPRESSED_MAX];
+	size_t out_pos;
+};
+
+struct len_enc {
+	uint16_t choice;
+	uint16_t choice2;
+	uint16_t low[POS_STATES_MAX][8];
+	uint16_t mid[POS_STATES_MAX][8];
+	uint16_t high[256];
+};
+
+struct lzma_enc {
+	uint32_t state;
+	uint32_t reps[REPS];
+
+	/* Everything in probs is reset to 1024 on state reset. */
+	struct {
+		uint16_t is_match[STATES][POS_STATES_MAX];
+		uint16_t is_rep[STATES];
+		uint16_t is_rep0[STATES];
+		uint16_t is_rep1[STATES];
+		uint16_t is_rep2[STATES];
+		uint16_t is_rep0_long[STATES][POS_STATES_MAX];
+		uint16_t dist_slot[DIST_STATES][DIST_SLOTS];
+		uint16_t dist_special[FULL_DISTANCES - DIST_MODEL_END];
+		uint16_t dist_align[1 << ALIGN_BITS];
+		struct len_enc match_len;
+		struct len_enc rep_len;
+		uint16_t literal[1 << LZMA_LC][0x300];
+	} probs;
+};
+
+static uint64_t rng;
+static struct rc_enc rc;
+static struct lzma_enc lzma;
+
+/*******************
+ * Helper routines *
+ *******************/
+
+static void fail(const char *msg)
+{
+	fprintf(stderr, "xzgen: %s\n", msg);
+	exit(1);
+}
+
+/* xorshift64* gives the same numbers on every platform. */
+static uint32_t rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return (uint32_t)((rng * UINT64_C(0x2545F4914F6CDD1D)) >> 32);
+}
+
+/* Return a random number in the range [0, n). */
+static uint32_t rnd_below(uint32_t n)
+{
+	return (uint32_t)(((uint64_t)rnd() * n) >> 32);
+}
+
+static bool rnd_pct(unsigned int pct)
+{
+	return rnd_below(100) < pct;
+}
+
+static void buf_put(struct buf *b, const uint8_t *data, size_t size)
+{
+	if (b->alloc - b->size < size) {
+		while (b->alloc - b->size < size)
+			b->alloc = b->alloc == 0 ? 4096 : b->alloc * 2;
+
+		b->data = realloc(b->data, b->alloc);
+		if (b->data == NULL)
+			fail("Memory allocation failed");
+	}
+
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+static void buf_byte(struct buf *b, uint8_t byte)
+{
+	buf_put(b, &byte, 1);
+}
+
+static void buf_le32(struct buf *b, uint32_t value)
+{
+	uint8_t tmp[4];
+
+	tmp[0] = (uint8_t)value;
+	tmp[1] = (uint8_t)(value >> 8);
+	tmp[2] = (uint8_t)(value >> 16);
+	tmp[3] = (uint8_t)(value >> 24);
+	buf_put(b, tmp, 4);
+}
+
+static void buf_vli(struct buf *b, uint64_t value)
+{
+	while (value >= 0x80) {
+		buf_byte(b, (uint8_t)value | 0x80);
+		value >>= 7;
+	}
+
+	buf_byte(b, (uint8_t)value);
+}
+
+/* Pad with zeros to a multiple of four bytes starting from start. */
+static void buf_pad(struct buf *b, size_t start)
+{
+	while ((b->size - start) & 3)
+		buf_byte(b, 0x00);
+}
+
+/*****************
+ * Range encoder *
+ *****************/
+
+static void rc_reset(void)
+{
+	rc.low = 0;
+	rc.range = UINT32_MAX;
+	rc.cache = 0;
+	rc.cache_size = 1;
+	rc.out_pos = 0;
+}
+
+static void rc_shift_low(void)
+{
+	uint8_t carry;
+
+	if ((uint32_t)rc.low < 0xFF000000 || (rc.low >> 32) != 0) {
+		carry = (uint8_t)(rc.low >> 32);
+
+		do {
+			rc.out[rc.out_pos++] = rc.cache + carry;
+			rc.cache = 0xFF;
+		} while (--rc.cache_size != 0);
+
+		rc.cache = (uint8_t)(rc.low >> 24);
+	}
+
+	++rc.cache_size;
+	rc.low = (rc.low & 0x00FFFFFF) << 8;
+}
+
+static void rc_normalize(void)
+{
+	if (rc.range < (1U << 24)) {
+		rc.range <<= 8;
+		rc_shift_low();
+	}
+}
+
+static void rc_flush(void)
+{
+	int i;
+
+	for (i = 0; i < 5; ++i)
+		rc_shift_low();
+}
+
+/* Return the number of bytes that the chunk will have after rc_flush(). */
+static size_t rc_pending(void)
+{
+	return rc.out_pos + rc.cache_size + 4;
+}
+
+static void rc_bit(uint16_t *prob, uint32_t bit)
+{
+	uint32_t bound = (rc.range >> 11) * *prob;
+
+	if (bit == 0) {
+		rc.range = bound;
+		*prob += (2048 - *prob) >> 5;
+	} else {
+		rc.low += bound;
+		rc.range -= bound;
+		*prob -= *prob >> 5;
+	}
+
+	rc_normalize();
+}
+
+static void rc_bittree(uint16_t *probs, uint32_t bits, uint32_t value)
+{
+	uint32_t symbol = 1;
+	uint32_t bit;
+
+	while (bits-- > 0) {
+		bit = (value >> bits) & 1;
+		rc_bit(&probs[symbol], bit);
+		symbol = (symbol << 1) | bit;
+	}
+}
+
+static void rc_bittree_reverse(uint16_t *probs, uint32_t bits,
+			       uint32_t value)
+{
+	uint32_t symbol = 1;
+	uint32_t bit;
+
+	while (bits-- > 0) {
+		bit = value & 1;
+		value >>= 1;
+		rc_bit(&probs[symbol], bit);
+		symbol = (symbol << 1) | bit;
+	}
+}
+
+static void rc_direct(uint32_t value, uint32_t bits)
+{
+	while (bits-- > 0) {
+		rc.range >>= 1;
+		if ((value >> bits) & 1)
+			rc.low += rc.range;
+
+		rc_normalize();
+	}
+}
+
+/****************
+ * LZMA encoder *
+ ****************/
+
+static void lzma_reset(void)
+{
+	uint16_t *probs = (uint16_t *)&lzma.probs;
+	size_t i;
+
+	lzma.state = 0;
+	for (i = 0; i < REPS; ++i)
+		lzma.reps[i] = 0;
+
+	for (i = 0; i < sizeof(lzma.probs) / sizeof(uint16_t); ++i)
+		probs[i] = 1024;
+}
+
+static void state_literal(void)
+{
+	if (lzma.state < 4)
+		lzma.state = 0;
+	else if (lzma.state < 10)
+		lzma.state -= 3;
+	else
+		lzma.state -= 6;
+}
+
+static void lzma_len(struct len_enc *l, uint32_t len, uint32_t pos_state)
+{
+	len -= MATCH_LEN_MIN;
+
+	if (len < 8) {
+		rc_bit(&l->choice, 0);
+		rc_bittree(l->low[pos_state], 3, len);
+	} else if (len < 16) {
+		rc_bit(&l->choice, 1);
+		rc_bit(&l->choice2, 0);
+		rc_bittree(l->mid[pos_state], 3, len - 8);
+	} else {
+		rc_bit(&l->choice, 1);
+		rc_bit(&l->choice2, 1);
+		rc_bittree(l->high, 8, len - 16);
+	}
+}
+
+/*
+ * Encode a literal. prev_byte is the previous byte or zero at the start
+ * of the dictionary. match_byte is the byte at rep0, which is needed
+ * after a match.
+ */
+static void lzma_literal(uint8_t byte, uint8_t prev_byte, uint8_t match_byte,
+			 uint32_t pos_state)
+{
+	uint16_t *probs = lzma.probs.literal[prev_byte >> (8 - LZMA_LC)];
+	uint32_t symbol = byte | 0x100;
+	uint32_t match = match_byte;
+	uint32_t offset = 0x100;
+	uint32_t match_bit;
+
+	rc_bit(&lzma.probs.is_match[lzma.state][pos_state], 0);
+
+	if (lzma.state < LIT_STATES) {
+		rc_bittree(probs, 8, byte);
+	} else {
+		do {
+			match <<= 1;
+			match_bit = match & offset;
+			rc_bit(&probs[offset + match_bit + (symbol >> 8)],
+					(symbol >> 7) & 1);
+			symbol <<= 1;
+			offset &= ~(match ^ symbol);
+		} while (symbol < 0x10000);
+	}
+
+	state_literal();
+}
+
+/* Encode a match with a new distance. dist is zero-based. */
+static void lzma_match(uint32_t len, uint32_t dist, uint32_t pos_state)
+{
+	uint32_t dist_state = len - MATCH_LEN_MIN < DIST_STATES
+			? len - MATCH_LEN_MIN : DIST_STATES - 1;
+	uint32_t slot;
+	uint32_t footer_bits;
+	uint32_t base;
+	uint32_t n;
+
+	rc_bit(&lzma.probs.is_match[lzma.state][pos_state], 1);
+	rc_bit(&lzma.probs.is_rep[lzma.state], 0);
+	lzma_len(&lzma.probs.match_len, len, pos_state);
+
+	if (dist < DIST_MODEL_START) {
+		slot = dist;
+	} else {
+		n = 31;
+		while ((dist >> n) == 0)
+			--n;
+
+		slot = 2 * n + ((dist >> (n - 1)) & 1);
+	}
+
+	rc_bittree(lzma.probs.dist_slot[dist_state], 6, slot);
+
+	if (slot >= DIST_MODEL_START) {
+		footer_bits = (slot >> 1) - 1;
+		base = (2 | (slot & 1)) << footer_bits;
+
+		if (slot < DIST_MODEL_END) {
+			rc_bittree_reverse(lzma.probs.dist_special
+					+ base - slot - 1,
+					footer_bits, dist - base);
+		} else {
+			rc_direct((dist - base) >> ALIGN_BITS,
+					footer_bits - ALIGN_BITS);
+			rc_bittree_reverse(lzma.probs.dist_align, ALIGN_BITS,
+					dist - base);
+		}
+	}
+
+	lzma.reps[3] = lzma.reps[2];
+	lzma.reps[2] = lzma.reps[1];
+	lzma.reps[1] = lzma.reps[0];
+	lzma.reps[0] = dist;
+	lzma.state = lzma.state < LIT_STATES ? 7 : 10;
+}
+
+/* Encode a repeated match. len == 1 means a short rep with rep0. */
+static void lzma_rep_match(uint32_t len, uint32_t rep, uint32_t pos_state)
+{
+	uint32_t dist;
+
+	rc_bit(&lzma.probs.is_match[lzma.state][pos_state], 1);
+	rc_bit(&lzma.probs.is_rep[lzma.state], 1);
+
+	if (rep == 0) {
+		rc_bit(&lzma.probs.is_rep0[lzma.state], 0);
+		rc_bit(&lzma.probs.is_rep0_long[lzma.state][pos_state],
+				len > 1);
+	} else {
+		rc_bit(&lzma.probs.is_rep0[lzma.state], 1);
+
+		if (rep == 1) {
+			rc_bit(&lzma.probs.is_rep1[lzma.state], 0);
+		} else {
+			rc_bit(&lzma.probs.is_rep1[lzma.state], 1);
+			rc_bit(&lzma.probs.is_rep2[lzma.state], rep == 3);
+		}
+
+		dist = lzma.reps[rep];
+		for (; rep > 0; --rep)
+			lzma.reps[rep] = lzma.reps[rep - 1];
+
+		lzma.reps[0] = dist;
+	}
+
+	if (len == 1) {
+		lzma.state = lzma.state < LIT_STATES ? 9 : 11;
+	} else {
+		lzma_len(&lzma.probs.rep_len, len, pos_state);
+		lzma.state = lzma.state < LIT_STATES ? 8 : 11;
+	}
+}
+
+/*******************
+ * Data generation *
+ *******************/
+
+static uint8_t random_literal(void)
+{
+	if (opt.alphabet < 96)
+		return (uint8_t)(' ' + rnd_below(opt.alphabet));
+
+	return (uint8_t)rnd_below(opt.alphabet);
+}
+
+/*
+ * Return a zero-based distance in the range [0, max]. The number of bits
+ * in the distance is uniformly distributed so that all distance slots
+ * get used.
+ */
+static uint32_t random_dist(uint32_t max)
+{
+	uint32_t bits = 0;
+	uint32_t dist;
+
+	while (bits < 32 && (max >> bits) != 0)
+		++bits;
+
+	bits = rnd_below(bits + 1);
+	if (bits == 0)
+		return 0;
+
+	dist = UINT32_C(1) << (bits - 1);
+	dist += rnd_below(dist);
+	return dist <= max ? dist : rnd_below(max) + 1;
+}
+
+/*
+ * Fill data[*pos] onwards with at most size bytes of LZMA symbols and
+ * encode them into rc.out. dict_start is the position of the latest
+ * dictionary reset. Return the number of bytes produced.
+ */
+static uint32_t lzma_chunk(uint8_t *data, size_t *pos, size_t dict_start,
+			   uint32_t dict_size, uint32_t size)
+{
+	size_t start = *pos;
+	size_t avail;
+	uint32_t left;
+	uint32_t pos_state;
+	uint32_t len;
+	uint32_t dist;
+	uint32_t rep;
+	uint32_t i;
+
+	while (*pos - start < size
+			&& rc_pending() + SYMBOL_SIZE_MAX
+				<= CHUNK_COMPRESSED_MAX) {
+		left = size - (uint32_t)(*pos - start);
+		pos_state = (uint32_t)(*pos - dict_start) & LZMA_PB_MASK;
+
+		avail = *pos - dict_start;
+		if (avail > dict_size)
+			avail = dict_size;
+
+		if (avail > opt.dist_max)
+			avail = opt.dist_max;
+
+		if (*pos - dict_start < DICT_WARMUP || left < MATCH_LEN_MIN
+				|| rnd_pct(opt.literal_pct)) {
+			data[*pos] = random_literal();
+			lzma_literal(data[*pos],
+					*pos > dict_start
+						? data[*pos - 1] : 0x00,
+					lzma.state < LIT_STATES ? 0x00
+						: data[*pos - lzma.reps[0] - 1],
+					pos_state);
+			++*pos;
+			continue;
+		}
+
+		len = MATCH_LEN_MIN + rnd_below(opt.len_max - 1);
+		if (len > left)
+			len = left;
+
+		/* Pick a random rep that points inside the dictionary. */
+		rep = REPS;
+		if (rnd_pct(opt.rep_pct)) {
+			rep = rnd_below(REPS);
+			while (rep < REPS && lzma.reps[rep] >= avail)
+				++rep;
+		}
+
+		if (rep < REPS) {
+			/* Some of the rep0 matches are short reps. */
+			if (rep == 0 && rnd_below(4) == 0)
+				len = 1;
+
+			lzma_rep_match(len, rep, pos_state);
+			dist = lzma.reps[0];
+		} else {
+			dist = random_dist((uint32_t)avail - 1);
+			lzma_match(len, dist, pos_state);
+		}
+
+		for (i = 0; i < len; ++i) {
+			data[*pos] = data[*pos - dist - 1];
+			++*pos;
+		}
+	}
+
+	return (uint32_t)(*pos - start);
+}
+
+/*
+ * Generate the uncompressed data of one Block into data and encode it
+ * as LZMA2 into out.
+ */
+static void lzma2_block(uint8_t *data, struct buf *out, uint32_t dict_size)
+{
+	size_t pos = 0;
+	size_t dict_start = 0;
+	unsigned int chunk;
+	bool need_props = true;
+	bool need_state_reset = false;
+	bool dict_reset;
+	uint8_t control;
+	uint32_t size;
+	uint32_t i;
+
+	for (chunk = 0; pos < opt.block_size; ++chunk) {
+		dict_reset = chunk == 0 || (opt.dict_reset > 0
+				&& chunk % opt.dict_reset == 0);
+		if (dict_reset)
+			dict_start = pos;
+
+		size = opt.chunk_size;
+		if (size > opt.block_size - pos)
+			size = (uint32_t)(opt.block_size - pos);
+
+		if (rnd_pct(opt.copy_pct)) {
+			/* Uncompressed chunk */
+			if (size > CHUNK_COPY_MAX)
+				size = CHUNK_COPY_MAX;
+
+			for (i = 0; i < size; ++i)
+				data[pos + i] = random_literal();
+
+			buf_byte(out, dict_reset ? 0x01 : 0x02);
+			buf_byte(out, (uint8_t)((size - 1) >> 8));
+			buf_byte(out, (uint8_t)(size - 1));
+			buf_put(out, data + pos, size);
+			pos += size;
+
+			if (dict_reset)
+				need_props = true;
+
+			need_state_reset = true;
+			continue;
+		}
+
+		if (dict_reset)
+			control = 0xE0;
+		else if (need_props)
+			control = 0xC0;
+		else if (need_state_reset || (opt.state_reset > 0
+				&& chunk % opt.state_reset == 0))
+			control = 0xA0;
+		else
+			control = 0x80;
+
+		if (control >= 0xA0)
+			lzma_reset();
+
+		rc_reset();
+		size = lzma_chunk(data, &pos, dict_start, dict_size, size);
+		rc_flush();
+
+		buf_byte(out, control | (uint8_t)((size - 1) >> 16));
+		buf_byte(out, (uint8_t)((size - 1) >> 8));
+		buf_byte(out, (uint8_t)(size - 1));
+		buf_byte(out, (uint8_t)((rc.out_pos - 1) >> 8));
+		buf_byte(out, (uint8_t)(rc.out_pos - 1));
+		if (control >= 0xC0)
+			buf_byte(out, LZMA_PROPS);
+
+		buf_put(out, rc.out, rc.out_pos);
+
+		need_props = false;
+		need_state_reset = false;
+	}
+
+	/* End of the LZMA2 data */
+	buf_byte(out, 0x00);
+}
+
+/******************
+ * .xz containers *
+ ******************/
+
+static size_t check_size(enum check check)
+{
+	switch (check) {
+	case CHECK_CRC32:
+		return 4;
+	case CHECK_CRC64:
+		return 8;
+	case CHECK_SHA256:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+static void stream_header(struct buf *out, enum check check)
+{
+	static const uint8_t magic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+	uint8_t flags[2] = { 0x00, (uint8_t)check };
+
+	buf_put(out, magic, sizeof(magic));
+	buf_put(out, flags, sizeof(flags));
+	buf_le32(out, xz_crc32(flags, sizeof(flags), 0));
+}
+
+/*
+ * Write a Block without the Check field. Return the Unpadded Size
+ * excluding the Check.
+ */
+static uint64_t block(struct buf *out, const struct buf *lzma2,
+		      uint64_t uncompressed, uint8_t dict_props)
+{
+	size_t start = out->size;
+	size_t header_size;
+
+	buf_byte(out, 0x00);
+	buf_byte(out, (uint8_t)((opt.bcj_id != 0) + (opt.delta_dist != 0))
+			| 0x40 | 0x80);
+	buf_vli(out, lzma2->size);
+	buf_vli(out, uncompressed);
+
+	if (opt.bcj_id != 0) {
+		buf_vli(out, opt.bcj_id);
+		buf_vli(out, 0);
+	}
+
+	if (opt.delta_dist != 0) {
+		buf_vli(out, 0x03);
+		buf_vli(out, 1);
+		buf_byte(out, (uint8_t)(opt.delta_dist - 1));
+	}
+
+	buf_vli(out, 0x21);
+	buf_vli(out, 1);
+	buf_byte(out, dict_props);
+
+	/* The Block Header Size includes the CRC32. */
+	buf_pad(out, start);
+	header_size = out->size - start + 4;
+	out->data[start] = (uint8_t)(header_size / 4 - 1);
+	buf_le32(out, xz_crc32(out->data + start, out->size - start, 0));
+
+	buf_put(out, lzma2->data, lzma2->size);
+	buf_pad(out, start);
+
+	return header_size + lzma2->size;
+}
+
+static void stream_end(struct buf *out, const uint64_t *unpadded,
+		       const uint64_t *uncompressed, unsigned int count,
+		       enum check check)
+{
+	size_t start = out->size;
+	uint8_t footer[6];
+	uint32_t backward_size;
+	unsigned int i;
+
+	buf_byte(out, 0x00);
+	buf_vli(out, count);
+
+	for (i = 0; i < count; ++i) {
+		buf_vli(out, unpadded[i]);
+		buf_vli(out, uncompressed[i]);
+	}
+
+	buf_pad(out, start);
+	buf_le32(out, xz_crc32(out->data + start, out->size - start, 0));
+
+	backward_size = (uint32_t)((out->size - start) / 4 - 1);
+	footer[0] = (uint8_t)backward_size;
+	footer[1] = (uint8_t)(backward_size >> 8);
+	footer[2] = (uint8_t)(backward_size >> 16);
+	footer[3] = (uint8_t)(backward_size >> 24);
+	footer[4] = 0x00;
+	footer[5] = (uint8_t)check;
+
+	buf_le32(out, xz_crc32(footer, sizeof(footer), 0));
+	buf_put(out, footer, sizeof(footer));
+	buf_put(out, (const uint8_t *)"YZ", 2);
+}
+
+/*
+ * Get the data that the decoder will produce from the Block. Without
+ * a BCJ or Delta filter it is the generated data as is.
+ */
+static const uint8_t *decoded_data(const uint8_t *data,
+				   const struct buf *lzma2,
+				   uint8_t dict_props)
+{
+	static struct buf tmp;
+	static uint8_t *out;
+	struct xz_dec *s;
+	struct xz_buf b;
+	uint64_t unpadded;
+	uint64_t uncompressed = opt.block_size;
+	enum xz_ret ret;
+
+	if (opt.bcj_id == 0 && opt.delta_dist == 0)
+		return data;
+
+	if (out == NULL) {
+		out = malloc(opt.block_size);
+		if (out == NULL)
+			fail("Memory allocation failed");
+	}
+
+	tmp.size = 0;
+	stream_header(&tmp, CHECK_NONE);
+	unpadded = block(&tmp, lzma2, opt.block_size, dict_props);
+	stream_end(&tmp, &unpadded, &uncompressed, 1, CHECK_NONE);
+
+	s = xz_dec_init(XZ_SINGLE, 0);
+	if (s == NULL)
+		fail("Memory allocation failed");
+
+	b.in = tmp.data;
+	b.in_pos = 0;
+	b.in_size = tmp.size;
+	b.out = out;
+	b.out_pos = 0;
+	b.out_size = opt.block_size;
+
+	ret = xz_dec_run(s, &b);
+	xz_dec_end(s);
+
+	if (ret != XZ_STREAM_END || b.out_pos != opt.block_size)
+		fail("Decoding the generated Block failed");
+
+	return out;
+}
+
+/********
+ * Main *
+ ********/
+
+static const struct {
+	const char *name;
+	uint8_t id;
+} bcj_filters[] = {
+	{ "x86", 0x04 },
+	{ "powerpc", 0x05 },
+	{ "ia64", 0x06 },
+	{ "arm", 0x07 },
+	{ "armthumb", 0x08 },
+	{ "sparc", 0x09 },
+	{ "arm64", 0x0A },
+	{ "riscv", 0x0B }
+};
+
+static void usage(FILE *file)
+{
+	fputs("Usage: xzgen [OPTION]... > FILE.xz\n"
+		"Generate a synthetic .xz file for benchmarking.\n\n"
+		"  -S SEED   seed of the random numbers (default 1)\n"
+		"  -s SIZE   uncompressed size of each Block "
+			"(default 1048576)\n"
+		"  -b COUNT  number of Blocks (default 1)\n"
+		"  -l PCT    percentage of literals among the LZMA symbols "
+			"after the first\n"
+		"            4096 bytes of each dictionary (default 50)\n"
+		"  -r PCT    percentage of repeated matches among the matches "
+			"(default 30)\n"
+		"  -d DIST   maximum match distance (default Block size)\n"
+		"  -m LEN    maximum match length, 2-273 (default 273)\n"
+		"  -a SIZE   number of different literal bytes, 1-256 "
+			"(default 256)\n"
+		"  -u PCT    percentage of uncompressed LZMA2 chunks "
+			"(default 0)\n"
+		"  -c SIZE   maximum uncompressed size of LZMA2 chunks "
+			"(default 2097152)\n"
+		"  -t N      reset the LZMA state every N chunks (default 0, "
+			"never)\n"
+		"  -D N      reset the dictionary every N chunks (default 0, "
+			"never)\n"
+		"  -f BCJ    x86, powerpc, ia64, arm, armthumb, sparc, arm64, "
+			"or riscv\n"
+		"  -e DIST   add a Delta filter with the distance 1-256\n"
+		"  -C CHECK  none, crc32, crc64, or sha256 (default crc32)\n",
+		file);
+}
+
+static unsigned long parse_num(const char *str, unsigned long min,
+			       unsigned long max)
+{
+	char *end;
+	unsigned long value = strtoul(str, &end, 0);
+
+	if (*str == '\0' || *end != '\0' || value < min || value > max) {
+		fprintf(stderr, "xzgen: Invalid number: %s\n", str);
+		exit(1);
+	}
+
+	return value;
+}
+
+static void parse_args(int argc, char **argv)
+{
+	int c;
+	size_t i;
+
+	if (argc >= 2 && strcmp(argv[1], "--help") == 0) {
+		usage(stdout);
+		exit(0);
+	}
+
+	while ((c = getopt(argc, argv, "S:s:b:l:r:d:m:a:u:c:t:D:f:e:C:"))
+			!= -1) {
+		switch (c) {
+		case 'S':
+			opt.seed = parse_num(optarg, 0, ULONG_MAX);
+			break;
+		case 's':
+			opt.block_size = parse_num(optarg, 1, UINT32_MAX);
+			break;
+		case 'b':
+			opt.blocks = parse_num(optarg, 1, 1 << 20);
+			break;
+		case 'l':
+			opt.literal_pct = parse_num(optarg, 0, 100);
+			break;
+		case 'r':
+			opt.rep_pct = parse_num(optarg, 0, 100);
+			break;
+		case 'd':
+			opt.dist_max = parse_num(optarg, 1, 3U << 30);
+			break;
+		case 'm':
+			opt.len_max = parse_num(optarg, MATCH_LEN_MIN,
+					MATCH_LEN_MAX);
+			break;
+		case 'a':
+			opt.alphabet = parse_num(optarg, 1, 256);
+			break;
+		case 'u':
+			opt.copy_pct = parse_num(optarg, 0, 100);
+			break;
+		case 'c':
+			opt.chunk_size = parse_num(optarg, 1,
+					CHUNK_UNCOMPRESSED_MAX);
+			break;
+		case 't':
+			opt.state_reset = parse_num(optarg, 0, UINT32_MAX);
+			break;
+		case 'D':
+			opt.dict_reset = parse_num(optarg, 0, UINT32_MAX);
+			break;
+		case 'f':
+			for (i = 0; i < sizeof(bcj_filters)
+					/ sizeof(bcj_filters[0]); ++i)
+				if (strcmp(optarg, bcj_filters[i].name) == 0)
+					opt.bcj_id = bcj_filters[i].id;
+
+			if (opt.bcj_id == 0)
+				fail("Unknown BCJ filter");
+
+			break;
+		case 'e':
+			opt.delta_dist = parse_num(optarg, 1, 256);
+			break;
+		case 'C':
+			if (strcmp(optarg, "none") == 0)
+				opt.check = CHECK_NONE;
+			else if (strcmp(optarg, "crc32") == 0)
+				opt.check = CHECK_CRC32;
+			else if (strcmp(optarg, "crc64") == 0)
+				opt.check = CHECK_CRC64;
+			else if (strcmp(optarg, "sha256") == 0)
+				opt.check = CHECK_SHA256;
+			else
+				fail("Unknown check type");
+
+			break;
+		default:
+			usage(stderr);
+			exit(1);
+		}
+	}
+
+	if (optind != argc) {
+		usage(stderr);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct buf out = { NULL, 0, 0 };
+	struct buf lzma2 = { NULL, 0, 0 };
+	uint8_t *data;
+	uint64_t *unpadded;
+	uint64_t *uncompressed;
+	const uint8_t *decoded;
+	struct xz_sha256 sha256;
+	uint8_t hash[32];
+	uint32_t dict_size;
+	uint8_t dict_props;
+	uint64_t crc64;
+	uint32_t crc32;
+	unsigned int i;
+	unsigned int j;
+
+	parse_args(argc, argv);
+
+#ifdef _WIN32
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	xz_crc32_init();
+	xz_crc64_init();
+
+	rng = opt.seed ^ UINT64_C(0x9E3779B97F4A7C15);
+	if (rng == 0)
+		rng = 1;
+
+	/* Use the smallest dictionary that covers the longest distance. */
+	dict_size = opt.dist_max;
+	if (dict_size > opt.block_size)
+		dict_size = (uint32_t)opt.block_size;
+
+	for (dict_props = 0; dict_props < 39; ++dict_props)
+		if (((uint32_t)(2 | (dict_props & 1)) << (dict_props / 2 + 11))
+				>= dict_size)
+			break;
+
+	dict_size = (uint32_t)(2 | (dict_props & 1)) << (dict_props / 2 + 11);
+
+	data = malloc(opt.block_size);
+	unpadded = malloc(opt.blocks * sizeof(*unpadded));
+	uncompressed = malloc(opt.blocks * sizeof(*uncompressed));
+	if (data == NULL || unpadded == NULL || uncompressed == NULL)
+		fail("Memory allocation failed");
+
+	stream_header(&out, opt.check);
+
+	for (i = 0; i < opt.blocks; ++i) {
+		lzma2.size = 0;
+		lzma2_block(data, &lzma2, dict_size);
+		decoded = decoded_data(data, &lzma2, dict_props);
+
+		unpadded[i] = block(&out, &lzma2, opt.block_size, dict_props)
+				+ check_size(opt.check);
+		uncompressed[i] = opt.block_size;
+
+		switch (opt.check) {
+		case CHECK_CRC32:
+			crc32 = xz_crc32(decoded, opt.block_size, 0);
+			buf_le32(&out, crc32);
+			break;
+
+		case CHECK_CRC64:
+			crc64 = xz_crc64(decoded, opt.block_size, 0);
+			buf_le32(&out, (uint32_t)crc64);
+			buf_le32(&out, (uint32_t)(crc64 >> 32));
+			break;
+
+		case CHECK_SHA256:
+			/*
+			 * xz_sha256_validate() leaves the hash in
+			 * sha256.state, so the comparison with hash
+			 * is only done to finish the calculation.
+			 */
+			xz_sha256_reset(&sha256);
+			xz_sha256_update(decoded, opt.block_size, &sha256);
+			memset(hash, 0, sizeof(hash));
+			xz_sha256_validate(hash, &sha256);
+
+			for (j = 0; j < 8; ++j)
+				put_unaligned_be32(sha256.state[j],
+						   hash + 4 * j);
+
+			buf_put(&out, hash, sizeof(hash));
+			break;
+
+		case CHECK_NONE:
+			break;
+		}
+	}
+
+	stream_end(&out, unpadded, uncompressed, opt.blocks, opt.check);
+
+	if (fwrite(out.data, 1, out.size, stdout) != out.size
+			|| fclose(stdout)) {
+		fail("Write error");
+	}
+
+	free(data);
+	free(unpadded);
+	free(uncompressed);
+	free(lzma2.data);
+	free(out.data);
+	return 0;
+}
@@ -13,33 +13,845 @@
  * sizes can be at most 64 MiB, but this can be modified by changing
  * DICT_SIZE_MAX.
  *
+ * When stdin is a regular file and no options are given, the file is
+ * mapped into memory instead of being read in small pieces. If stdout
+ * is a regular file opened for both reading and writing, the total
+ * uncompressed size is taken from the Indexes and the file is decoded
+ * in single-call mode straight into the mapped output file, which then
+ * needs no dictionary buffer either.
+ *
+ * Files named on the command line are decoded to files without the .xz
+ * suffix. With -T, several files are decoded at the same time. Each
+ * thread reuses its decoders and thus the dictionary buffer too.
+ *
+ * On Linux, when stdout is a pipe, full output buffers are given to the
+ * pipe with vmsplice() instead of being copied with write().
+ *
+ * With -a, stdin is decoded to stdout with io_uring so that the next
+ * input buffer is read and the previous output buffer is written while
+ * the current one is being decoded.
+ *
  * See xzdec from XZ Utils if a few KiB bigger tool is not a problem.
  */
 
+/* vmsplice() needs _GNU_SOURCE. */
+#ifdef __linux__
+#	define _GNU_SOURCE
+#endif
+
 #include <stdbool.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "xz.h"
 
 #ifdef _WIN32
 #	include <io.h>
 #	include <fcntl.h>
+#	include <windows.h>
+#else
+#	include <unistd.h>
+#	include <fcntl.h>
+#	include <pthread.h>
+#endif
+
+/*
+ * Regular files are mapped into memory. The Indexes are used to get the
+ * uncompressed size, so xz_probe_tail() is needed for that.
+ */
+#if !defined(_WIN32) && defined(XZ_DEC_PROBE)
+#	define USE_MMAP
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#	define USE_VMSPLICE
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <sys/uio.h>
+#endif
+
+#ifdef XZ_USE_URING
+#	include "xz_config.h"
 #endif
 
 #ifndef DICT_SIZE_MAX
 #	define DICT_SIZE_MAX (64U << 20)
 #endif
 
+/* Size of the output buffer when the input file is mapped */
+#define MAPPED_OUT_SIZE (1U << 20)
+
+
 static uint8_t in[BUFSIZ];
 static uint8_t out[BUFSIZ];
 
+static const char *argv0;
+
+/* Decoders that are reused for each file decoded by one thread */
+struct decoders {
+	struct xz_dec *multi;
+
+	/* Single-call decoder for mapped files, allocated when needed */
+	struct xz_dec *single;
+};
+
+/* Files given on the command line and the index of the next one */
+static char **files;
+static int files_count;
+static int files_next;
+static bool files_failed;
+
+#ifndef _WIN32
+static pthread_mutex_t files_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#ifdef USE_VMSPLICE
+/*
+ * Page-aligned output buffer for stdout when it is a pipe, and its size,
+ * which is the size of the pipe. vmsplice() puts references to the pages
+ * of a full buffer into the pipe without copying them. The pages may be
+ * used long after they have left the pipe: a reader that uses splice()
+ * can move them to another pipe or a file, so the amount of unread data
+ * in the pipe doesn't tell when they are free again. Thus a buffer is
+ * never reused after vmsplice(). It is unmapped, which leaves the pages
+ * only to the pipe, and a new buffer is mapped for the next output.
+ * Partial buffers are copied with write() and can be reused.
+ */
+static uint8_t *vmsplice_buf;
+static size_t vmsplice_size;
+#endif
+
+/* Print a message to stderr. name is NULL when decoding stdin. */
+static void message(const char *name, const char *msg)
+{
+#ifndef _WIN32
+	flockfile(stderr);
+#endif
+	fputs(argv0, stderr);
+	fputs(": ", stderr);
+
+	if (name != NULL) {
+		fputs(name, stderr);
+		fputs(": ", stderr);
+	}
+
+	fputs(msg, stderr);
+#ifndef _WIN32
+	funlockfile(stderr);
+#endif
+}
+
+
+#ifdef USE_VMSPLICE
+/*
+ * If out_file is stdout and it is a pipe, make b->out point to
+ * vmsplice_buf. A new buffer is mapped if there is none.
+ */
+static bool vmsplice_start(struct xz_buf *b, FILE *out_file)
+{
+	struct stat st;
+	int pipe_size;
+	void *buf;
+
+	if (out_file != stdout)
+		return false;
+
+	if (vmsplice_size == 0) {
+		if (fstat(STDOUT_FILENO, &st) != 0 || !S_ISFIFO(st.st_mode))
+			return false;
+
+		pipe_size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+		if (pipe_size <= 0)
+			return false;
+
+		vmsplice_size = (size_t)pipe_size;
+	}
+
+	if (vmsplice_buf == NULL) {
+		buf = mmap(NULL, vmsplice_size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			return false;
+
+		vmsplice_buf = buf;
+	}
+
+	b->out = vmsplice_buf;
+	b->out_pos = 0;
+	b->out_size = vmsplice_size;
+	return true;
+}
+
+/* Give the full buffer b->out to the pipe and map a new buffer. */
+static bool vmsplice_out(struct xz_buf *b)
+{
+	struct iovec iov;
+	ssize_t n;
+
+	iov.iov_base = b->out;
+	iov.iov_len = b->out_pos;
+
+	while (iov.iov_len > 0) {
+		n = vmsplice(STDOUT_FILENO, &iov, 1, SPLICE_F_GIFT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		iov.iov_base = (uint8_t *)iov.iov_base + n;
+		iov.iov_len -= (size_t)n;
+	}
+
+	munmap(vmsplice_buf, vmsplice_size);
+	vmsplice_buf = NULL;
+	return vmsplice_start(b, stdout);
+}
+#endif
+
+/* Write b->out[0] to b->out[b->out_pos - 1] to out_file and empty b->out. */
+static bool write_out(struct xz_buf *b, FILE *out_file)
+{
+#ifdef USE_VMSPLICE
+	if (out_file == stdout && vmsplice_buf != NULL) {
+		if (b->out_pos == b->out_size)
+			return vmsplice_out(b);
+
+		/* Keep the order with the data given with vmsplice(). */
+		if (fwrite(b->out, 1, b->out_pos, stdout) != b->out_pos
+				|| fflush(stdout))
+			return false;
+
+		b->out_pos = 0;
+		return true;
+	}
+#endif
+
+	if (fwrite(b->out, 1, b->out_pos, out_file) != b->out_pos)
+		return false;
+
+	b->out_pos = 0;
+	return true;
+}
+
+static const char *error_msg(enum xz_ret ret)
+{
+	switch (ret) {
+	case XZ_MEM_ERROR:
+		return "Memory allocation failed\n";
+
+	case XZ_MEMLIMIT_ERROR:
+		return "Memory usage limit reached\n";
+
+	case XZ_FORMAT_ERROR:
+		return "Not a .xz file\n";
+
+	case XZ_OPTIONS_ERROR:
+		return "Unsupported options in the .xz headers\n";
+
+	case XZ_DATA_ERROR:
+	case XZ_BUF_ERROR:
+		return "File is corrupt\n";
+
+	default:
+		return "Bug!\n";
+	}
+}
+
+#ifdef USE_MMAP
+/*
+ * Get the total uncompressed size of the file from the Indexes of all
+ * Streams, starting from the last one. Return XZ_SIZE_UNKNOWN if the
+ * file isn't valid; the decoder will then tell what is wrong with it.
+ */
+static uint64_t uncompressed_size(const uint8_t *buf, size_t size)
+{
+	struct xz_info info;
+	uint64_t total = 0;
+
+	while (size > 0) {
+		if (xz_probe_tail(buf, size, &info) != XZ_OK)
+			return XZ_SIZE_UNKNOWN;
+
+		/* The Stream Footer never ends with a null byte. */
+		while (buf[size - 1] == 0)
+			--size;
+
+		if (info.stream_compressed > size || info.stream_uncompressed
+				> XZ_SIZE_UNKNOWN - 1 - total)
+			return XZ_SIZE_UNKNOWN;
+
+		size -= info.stream_compressed;
+		total += info.stream_uncompressed;
+	}
+
+	return total;
+}
+
+/*
+ * If fd is a regular file at offset zero that is open for reading
+ * and writing, set its size and map it into memory.
+ */
+static uint8_t *map_output(int fd, uint64_t size)
+{
+	struct stat st;
+	void *map;
+
+	if (size == 0 || size > SIZE_MAX || fstat(fd, &st) != 0
+			|| !S_ISREG(st.st_mode)
+			|| (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDWR
+			|| lseek(fd, 0, SEEK_CUR) != 0
+			|| ftruncate(fd, (off_t)size) != 0)
+		return NULL;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	return map;
+}
+
+/*
+ * Decode the whole file at once with XZ_SINGLE straight into the mapped
+ * output file. XZ_UNSUPPORTED_CHECK can't be ignored in single-call mode
+ * so then *ret is set to it and the caller should use multi-call mode.
+ */
+static bool decode_single(struct decoders *dec, const uint8_t *in_map,
+			  size_t in_size, int out_fd, enum xz_ret *ret)
+{
+	struct xz_buf b;
+	uint64_t out_size;
+	uint8_t *out_map;
+
+	out_size = uncompressed_size(in_map, in_size);
+	if (out_size == XZ_SIZE_UNKNOWN)
+		return false;
+
+	if (dec->single == NULL) {
+		dec->single = xz_dec_init(XZ_SINGLE, 0);
+		if (dec->single == NULL)
+			return false;
+	}
+
+	out_map = map_output(out_fd, out_size);
+	if (out_map == NULL)
+		return false;
+
+	b.in = in_map;
+	b.in_pos = 0;
+	b.in_size = in_size;
+	b.out = out_map;
+	b.out_pos = 0;
+	b.out_size = out_size;
+
+	*ret = xz_dec_catrun(dec->single, &b, true);
+
+	munmap(out_map, out_size);
+
+	if (*ret == XZ_STREAM_END)
+		lseek(out_fd, (off_t)out_size, SEEK_SET);
+
+	return *ret != XZ_UNSUPPORTED_CHECK;
+}
+
+/*
+ * If in_file is a regular file, map it into memory and decode it. Use
+ * single-call mode if possible and otherwise dec->multi with a big output
+ * buffer. Return false if in_file can't be mapped; then nothing has been
+ * done. Otherwise return true and set *msg to NULL on success or to an
+ * error message on failure.
+ */
+static bool decode_mapped(struct decoders *dec, FILE *in_file,
+			  FILE *out_file, const char *name, const char **msg)
+{
+	struct stat st;
+	struct xz_buf b;
+	enum xz_ret ret;
+	int in_fd = fileno(in_file);
+	uint8_t *in_map;
+	size_t in_size;
+	uint8_t *out_buf;
+
+#ifndef XZ_DEC_ANY_CHECK
+	(void)name;
+#endif
+
+	if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode)
+			|| st.st_size == 0 || (uint64_t)st.st_size > SIZE_MAX
+			|| lseek(in_fd, 0, SEEK_CUR) != 0)
+		return false;
+
+	in_size = (size_t)st.st_size;
+	in_map = mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+	if (in_map == MAP_FAILED)
+		return false;
+
+	madvise(in_map, in_size, MADV_SEQUENTIAL);
+
+	if (decode_single(dec, in_map, in_size, fileno(out_file), &ret)) {
+		munmap(in_map, in_size);
+		*msg = ret == XZ_STREAM_END ? NULL : error_msg(ret);
+		return true;
+	}
+
+	b.in = in_map;
+	b.in_pos = 0;
+	b.in_size = in_size;
+	out_buf = NULL;
+
+#ifdef USE_VMSPLICE
+	if (!vmsplice_start(&b, out_file))
+#endif
+	{
+		out_buf = malloc(MAPPED_OUT_SIZE);
+		if (out_buf == NULL) {
+			munmap(in_map, in_size);
+			*msg = error_msg(XZ_MEM_ERROR);
+			return true;
+		}
+
+		b.out = out_buf;
+		b.out_pos = 0;
+		b.out_size = MAPPED_OUT_SIZE;
+	}
+
+	while (true) {
+		ret = xz_dec_catrun(dec->multi, &b, true);
+
+#ifdef XZ_DEC_ANY_CHECK
+		if (ret == XZ_UNSUPPORTED_CHECK) {
+			message(name, "Unsupported check; not verifying "
+					"file integrity\n");
+			continue;
+		}
+#endif
+
+		if ((ret != XZ_OK || b.out_pos == b.out_size)
+				&& !write_out(&b, out_file)) {
+			*msg = "Write error\n";
+			break;
+		}
+
+		if (ret != XZ_OK) {
+			*msg = ret == XZ_STREAM_END ? NULL : error_msg(ret);
+			break;
+		}
+	}
+
+	free(out_buf);
+	munmap(in_map, in_size);
+	return true;
+}
+#endif
+
+/*
+ * Decode in multi-call mode from in_file to out_file. Return NULL on
+ * success and an error message on failure.
+ */
+static const char *decode_stream(struct xz_dec *s, FILE *in_file,
+				 FILE *out_file, const char *name)
+{
+	uint8_t in_buf[BUFSIZ];
+	uint8_t out_buf[BUFSIZ];
+	struct xz_buf b;
+	enum xz_ret ret;
+
+#ifndef XZ_DEC_ANY_CHECK
+	(void)name;
+#endif
+
+	b.in = in_buf;
+	b.in_pos = 0;
+	b.in_size = 0;
+	b.out = out_buf;
+	b.out_pos = 0;
+	b.out_size = sizeof(out_buf);
+
+	while (true) {
+		if (b.in_pos == b.in_size) {
+			b.in_size = fread(in_buf, 1, sizeof(in_buf), in_file);
+			if (ferror(in_file))
+				return "Read error\n";
+
+			b.in_pos = 0;
+		}
+
+		ret = xz_dec_catrun(s, &b, b.in_size == 0);
+
+#ifdef XZ_DEC_ANY_CHECK
+		if (ret == XZ_UNSUPPORTED_CHECK) {
+			message(name, "Unsupported check; not verifying "
+					"file integrity\n");
+			continue;
+		}
+#endif
+
+		if ((ret != XZ_OK || b.out_pos == b.out_size)
+				&& !write_out(&b, out_file))
+			return "Write error\n";
+
+		if (ret != XZ_OK)
+			return ret == XZ_STREAM_END ? NULL : error_msg(ret);
+	}
+}
+
+/* Decode FILE.xz to FILE. Return false and print a message on error. */
+static bool decode_file(struct decoders *dec, const char *name)
+{
+	size_t len = strlen(name);
+	char *out_name;
+	FILE *in_file;
+	FILE *out_file;
+	const char *msg;
+
+	if (len <= 3 || strcmp(name + len - 3, ".xz") != 0) {
+		message(name, "File name doesn't end in .xz\n");
+		return false;
+	}
+
+	out_name = malloc(len - 2);
+	if (out_name == NULL) {
+		message(name, error_msg(XZ_MEM_ERROR));
+		return false;
+	}
+
+	memcpy(out_name, name, len - 3);
+	out_name[len - 3] = '\0';
+
+	in_file = fopen(name, "rb");
+	if (in_file == NULL) {
+		message(name, "Cannot open the file\n");
+		free(out_name);
+		return false;
+	}
+
+	/*
+	 * The output is opened for reading too so that it can be mapped.
+	 * An existing file is never overwritten. The "x" mode is from C11.
+	 */
+	out_file = fopen(out_name, "wb+x");
+	if (out_file == NULL) {
+		message(out_name, errno == EEXIST ? "File exists\n"
+				: "Cannot create the file\n");
+		fclose(in_file);
+		free(out_name);
+		return false;
+	}
+
+	xz_dec_reset(dec->multi);
+
+#ifdef USE_MMAP
+	if (!decode_mapped(dec, in_file, out_file, name, &msg))
+#endif
+		msg = decode_stream(dec->multi, in_file, out_file, name);
+
+	fclose(in_file);
+	if (fclose(out_file) && msg == NULL)
+		msg = "Write error\n";
+
+	if (msg != NULL) {
+		message(name, msg);
+		remove(out_name);
+	}
+
+	free(out_name);
+	return msg == NULL;
+}
+
+/* Make the exit status nonzero without taking a file. */
+static void files_fail(void)
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&files_mutex);
+#endif
+	files_failed = true;
+#ifndef _WIN32
+	pthread_mutex_unlock(&files_mutex);
+#endif
+}
+
+/*
+ * Get the name of the next file to decode, or NULL if all have been
+ * taken. failed tells if the previous file of the caller failed.
+ */
+static const char *next_file(bool failed)
+{
+	const char *name = NULL;
+
+#ifndef _WIN32
+	pthread_mutex_lock(&files_mutex);
+#endif
+	if (failed)
+		files_failed = true;
+
+	if (files_next < files_count)
+		name = files[files_next++];
+#ifndef _WIN32
+	pthread_mutex_unlock(&files_mutex);
+#endif
+
+	return name;
+}
+
+static void *decode_files_thread(void *arg)
+{
+	struct decoders dec;
+	const char *name;
+	bool failed = false;
+
+	(void)arg;
+
+	dec.single = NULL;
+	/*
+	 * The files are left to the other threads. If this is the only
+	 * thread, they remain undecoded, which the exit status tells.
+	 */
+	dec.multi = xz_dec_init(XZ_DYNALLOC, DICT_SIZE_MAX);
+	if (dec.multi == NULL) {
+		message(NULL, error_msg(XZ_MEM_ERROR));
+		files_fail();
+		return NULL;
+	}
+
+	while ((name = next_file(failed)) != NULL)
+		failed = !decode_file(&dec, name);
+
+	xz_dec_end(dec.single);
+	xz_dec_end(dec.multi);
+	return NULL;
+}
+
+#ifdef XZ_USE_URING
+/*
+ * Decode stdin to stdout with the io_uring driver. Return false if
+ * io_uring cannot be used. Otherwise *msg is set to NULL on success
+ * or to an error message.
+ */
+static bool decode_uring(struct xz_dec *s, const char **msg)
+{
+	struct xz_uring *u;
+	enum xz_ret ret;
+
+	u = xz_uring_init(STDIN_FILENO, STDOUT_FILENO);
+	if (u == NULL)
+		return false;
+
+	while (true) {
+		if (xz_uring_run(u, s, &ret)) {
+			*msg = "Read or write error\n";
+			break;
+		}
+
+#ifdef XZ_DEC_ANY_CHECK
+		if (ret == XZ_UNSUPPORTED_CHECK) {
+			message(NULL, "Unsupported check; not verifying "
+					"file integrity\n");
+			continue;
+		}
+#endif
+
+		*msg = ret == XZ_STREAM_END ? NULL : error_msg(ret);
+		break;
+	}
+
+	xz_uring_end(u);
+	return true;
+}
+#endif
+
+#ifdef XZ_DEC_EVENTS
+/* Uncompressed offset of the end of the last verified Block in follow mode */
+static uint64_t follow_verified;
+
+static void follow_event(void *opaque, const struct xz_event *event)
+{
+	(void)opaque;
+
+	if (event->type == XZ_EVENT_BLOCK_END)
+		follow_verified = event->out_offset + event->uncompressed;
+}
+
+/* Wait a moment before checking if the input file has grown. */
+static void wait_for_input(void)
+{
+#ifdef _WIN32
+	Sleep(1000);
+#else
+	sleep(1);
+#endif
+}
+
+/*
+ * Decode stdin to stdout without treating the end of the input as the end
+ * of the file, so that a file that is still being written can be read.
+ * When all input has been used, stdin is checked again once a second.
+ *
+ * Only whole Blocks are written, once the XZ_EVENT_BLOCK_END event has
+ * told that the integrity check of the Block has been verified. Output
+ * from a Block that is incomplete or turns out to be corrupt is never
+ * written. Thus the output of the current Block is kept in memory, and
+ * the buffer grows to the size of the biggest Block.
+ *
+ * This returns only on error.
+ */
+static const char *decode_follow(struct xz_dec *s)
+{
+	struct xz_buf b;
+	uint8_t *buf;
+	uint8_t *new_buf;
+	size_t size = BUFSIZ;
+	size_t n;
+	uint64_t written = 0;
+	enum xz_ret ret;
+	const char *msg;
+	bool out_was_full = false;
+
+	buf = malloc(size);
+	if (buf == NULL)
+		return error_msg(XZ_MEM_ERROR);
+
+	xz_dec_set_event_cb(s, &follow_event, NULL);
+
+	b.in = in;
+	b.in_pos = 0;
+	b.in_size = 0;
+	b.out = buf;
+	b.out_pos = 0;
+	b.out_size = size;
+
+	while (true) {
+		if (b.in_pos == b.in_size) {
+			b.in_size = fread(in, 1, sizeof(in), stdin);
+			if (ferror(stdin)) {
+				msg = "Read error\n";
+				break;
+			}
+
+			b.in_pos = 0;
+
+			/*
+			 * If the decoder has used all the input and there
+			 * is no pending output, wait for the file to grow.
+			 * The decoder isn't called until there is more
+			 * input so that it won't return XZ_BUF_ERROR.
+			 */
+			if (b.in_size == 0 && !out_was_full) {
+				clearerr(stdin);
+				wait_for_input();
+				continue;
+			}
+		}
+
+		ret = xz_dec_catrun(s, &b, false);
+
+#ifdef XZ_DEC_ANY_CHECK
+		if (ret == XZ_UNSUPPORTED_CHECK) {
+			message(NULL, "Unsupported check; not verifying "
+					"file integrity\n");
+			continue;
+		}
+#endif
+
+		/* XZ_STREAM_END isn't possible without finishing. */
+		if (ret != XZ_OK) {
+			msg = error_msg(ret);
+			break;
+		}
+
+		/* Write the Blocks that have been verified. */
+		n = (size_t)(follow_verified - written);
+		if (n > 0) {
+			if (fwrite(buf, 1, n, stdout) != n || fflush(stdout)) {
+				msg = "Write error\n";
+				break;
+			}
+
+			memmove(buf, buf + n, b.out_pos - n);
+			b.out_pos -= n;
+			written += n;
+		}
+
+		/* Make room for the rest of the current Block. */
+		out_was_full = b.out_pos == b.out_size;
+		if (out_was_full) {
+			new_buf = realloc(buf, size * 2);
+			if (new_buf == NULL) {
+				msg = error_msg(XZ_MEM_ERROR);
+				break;
+			}
+
+			buf = new_buf;
+			size *= 2;
+			b.out = buf;
+			b.out_size = size;
+		}
+	}
+
+	free(buf);
+	return msg;
+}
+#endif
+
+/*
+ * Decode the files using the given number of threads. The main thread is
+ * one of them. Return the exit status.
+ */
+static int decode_files(char **names, int count, int threads)
+{
+#ifndef _WIN32
+	pthread_t *tids;
+	int i;
+#endif
+
+	files = names;
+	files_count = count;
+
+#ifdef _WIN32
+	(void)threads;
+#else
+	if (threads > count)
+		threads = count;
+
+	tids = threads > 1 ? malloc((threads - 1) * sizeof(*tids)) : NULL;
+	if (tids == NULL)
+		threads = 1;
+
+	/* If a thread can't be created, fewer threads are used. */
+	for (i = 0; i < threads - 1; ++i)
+		if (pthread_create(&tids[i], NULL, &decode_files_thread, NULL))
+			break;
+
+	threads = i + 1;
+#endif
+
+	decode_files_thread(NULL);
+
+#ifndef _WIN32
+	for (i = 0; i < threads - 1; ++i)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+#endif
+
+	return files_failed;
+}
+
 int main(int argc, char **argv)
 {
 	struct xz_buf b;
+#ifdef USE_MMAP
+	struct decoders dec;
+#endif
 	struct xz_dec *s;
 	enum xz_ret ret;
 	const char *msg;
 
+	argv0 = argv[0];
+
 #ifdef _WIN32
 	_setmode(_fileno(stdin), _O_BINARY);
 	_setmode(_fileno(stdout), _O_BINARY);
@@ -47,7 +859,24 @@ int main(int argc, char **argv)
 
 	if (argc >= 2 && strcmp(argv[1], "--help") == 0) {
 		fputs("Uncompress a .xz file from stdin to stdout.\n"
-				"Arguments other than `--help' are ignored.\n",
+				"With `FILE.xz...', uncompress each file "
+				"to FILE, which must not exist.\n"
+				"With `-T N FILE.xz...', uncompress up to N "
+				"files at the same time.\n"
+#ifdef XZ_DEC_EVENTS
+				"With `-f', keep waiting for more input at "
+				"the end of the file and write\neach Block "
+				"once its integrity check has been verified.\n"
+#endif
+#ifdef XZ_USE_URING
+				"With `-a', read and write with io_uring "
+				"while decoding.\n"
+#endif
+#ifdef XZ_DEC_SKIP
+				"With `-t', only test the integrity of "
+				"the file.\n"
+#endif
+				"Other options are ignored.\n",
 				stdout);
 		return 0;
 	}
@@ -57,6 +886,12 @@ int main(int argc, char **argv)
 	xz_crc64_init();
 #endif
 
+	if (argc >= 4 && strcmp(argv[1], "-T") == 0)
+		return decode_files(argv + 3, argc - 3, atoi(argv[2]));
+
+	if (argc >= 2 && argv[1][0] != '-')
+		return decode_files(argv + 1, argc - 1, 1);
+
 	/*
 	 * Support up to 64 MiB dictionary. The actually needed memory
 	 * is allocated once the headers have been parsed.
@@ -73,6 +908,61 @@ int main(int argc, char **argv)
 	b.out = out;
 	b.out_pos = 0;
 	b.out_size = BUFSIZ;
+#ifdef USE_VMSPLICE
+	vmsplice_start(&b, stdout);
+#endif
+
+#ifdef XZ_DEC_SKIP
+	/*
+	 * When testing, the uncompressed data is decoded only into the
+	 * dictionary and nothing is written to b->out.
+	 */
+	if (argc >= 2 && strcmp(argv[1], "-t") == 0)
+		xz_dec_skip(s, XZ_SKIP_ALL);
+#endif
+
+#ifdef XZ_USE_URING
+	/* If io_uring isn't available, the stdio loop is used instead. */
+	if (argc >= 2 && strcmp(argv[1], "-a") == 0
+			&& decode_uring(s, &msg)) {
+		if (msg != NULL)
+			goto error;
+
+		xz_dec_end(s);
+		return 0;
+	}
+#endif
+
+#ifdef XZ_DEC_EVENTS
+	if (argc >= 2 && strcmp(argv[1], "-f") == 0) {
+		msg = decode_follow(s);
+		goto error;
+	}
+#endif
+
+#ifdef USE_MMAP
+	/*
+	 * A regular file is decoded from memory. The output goes straight
+	 * into the output file if it can be mapped too, which needs
+	 * `1<>file' instead of `>file' in the shell.
+	 */
+	dec.multi = s;
+	dec.single = NULL;
+
+	if (argc < 2 && decode_mapped(&dec, stdin, stdout, NULL, &msg)) {
+		xz_dec_end(dec.single);
+		if (msg != NULL)
+			goto error;
+
+		if (fclose(stdout)) {
+			msg = "Write error\n";
+			goto error;
+		}
+
+		xz_dec_end(s);
+		return 0;
+	}
+#endif
 
 	while (true) {
 		if (b.in_pos == b.in_size) {
@@ -94,13 +984,9 @@ int main(int argc, char **argv)
 		 */
 		ret = xz_dec_catrun(s, &b, b.in_size == 0);
 
-		if (b.out_pos == sizeof(out)) {
-			if (fwrite(out, 1, b.out_pos, stdout) != b.out_pos) {
-				msg = "Write error\n";
-				goto error;
-			}
-
-			b.out_pos = 0;
+		if (b.out_pos == b.out_size && !write_out(&b, stdout)) {
+			msg = "Write error\n";
+			goto error;
 		}
 
 		if (ret == XZ_OK)
@@ -108,56 +994,28 @@ int main(int argc, char **argv)
 
 #ifdef XZ_DEC_ANY_CHECK
 		if (ret == XZ_UNSUPPORTED_CHECK) {
-			fputs(argv[0], stderr);
-			fputs(": ", stderr);
-			fputs("Unsupported check; not verifying "
-					"file integrity\n", stderr);
+			message(NULL, "Unsupported check; not verifying "
+					"file integrity\n");
 			continue;
 		}
 #endif
 
-		if (fwrite(out, 1, b.out_pos, stdout) != b.out_pos
-				|| fclose(stdout)) {
+		if (!write_out(&b, stdout) || fclose(stdout)) {
 			msg = "Write error\n";
 			goto error;
 		}
 
-		switch (ret) {
-		case XZ_STREAM_END:
+		if (ret == XZ_STREAM_END) {
 			xz_dec_end(s);
 			return 0;
-
-		case XZ_MEM_ERROR:
-			msg = "Memory allocation failed\n";
-			goto error;
-
-		case XZ_MEMLIMIT_ERROR:
-			msg = "Memory usage limit reached\n";
-			goto error;
-
-		case XZ_FORMAT_ERROR:
-			msg = "Not a .xz file\n";
-			goto error;
-
-		case XZ_OPTIONS_ERROR:
-			msg = "Unsupported options in the .xz headers\n";
-			goto error;
-
-		case XZ_DATA_ERROR:
-		case XZ_BUF_ERROR:
-			msg = "File is corrupt\n";
-			goto error;
-
-		default:
-			msg = "Bug!\n";
-			goto error;
 		}
+
+		msg = error_msg(ret);
+		goto error;
 	}
 
 error:
 	xz_dec_end(s);
-	fputs(argv[0], stderr);
-	fputs(": ", stderr);
-	fputs(msg, stderr);
+	message(NULL, msg);
 	return 1;
 }